@@ -1,10 +1,34 @@
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cstring>
+#endif
 #include <iostream>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <limits>
 #include <iomanip>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <type_traits>
 
 using std::cout;
 using std::endl;
@@ -15,41 +39,253 @@ enum class RoomType { bedroom, kitchen, bathroom, restroom, playroom, living, ma
 enum class FloorType { first, second, third, undefined };
 enum class BuildingType { house, garage, shed, bathHouse, undefined };
 
+// Общие для всех элементов данные (path, названия типов, ограничения) хранятся один раз на тип.
+// В каждом элементе остаются лишь его собственные значения
 struct Room {
+    static const char* const path;
+    static const vector<string> roomNames;
     int id{};
     RoomType type = RoomType::undefined;
-    const char* path = "AREA/SECTOR/BUILDING/FLOOR/ROOM";
-    vector<string> roomNames = { "bedroom", "kitchen", "bathroom", "restroom", "playroom", "living", "main", "undefined" };
     int width = 2000;
     int length = 1000;
 };
 struct Floor {
+    static const char* const path;
+    static const vector<string> floorNames;
+    static const int maxRoomCount = 4;
     int id{};
     FloorType type = FloorType::undefined;
-    const char* path = "AREA/SECTOR/BUILDING/FLOOR";
-    vector<string> floorNames = { "first", "second", "third", "undefined" };
     int height = 2000;
-    int maxRoomCount = 4;
     vector<Room> children;
 };
 struct Building {
+    static const char* const path;
+    static const vector<string> buildingNames;
+    static const int maxFloorCountForHouse = 3;
+    // Допустимые габариты размещённого на плане здания
+    static const int minPlacedSize = 1000;
+    static const int maxPlacedSize = 50000;
     int id{};
     BuildingType type = BuildingType::undefined;
-    const char* path = "AREA/SECTOR/BUILDING";
-    vector<string> buildingNames = { "house", "garage", "shed", "bathHouse", "undefined" };
     bool isStove = false;
-    int maxFloorCountForHouse = 3;
+    // Расположение на плане участка (необязательно). Координаты и размеры в мм
+    bool isPlaced = false;
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int length = 0;
     vector<Floor> children;
 };
+struct SectorSpatialIndex;
+struct AreaSummary;
 struct Sector {
+    static const char* const path;
     int id{};
-    const char* path = "AREA/SECTOR";
+    // Размеры участка в мм. 0 - размеры неизвестны
+    int plotWidth = 0;
+    int plotLength = 0;
     vector<Building> children;
+    // План участка строится при публикации версии и разделяется её копиями.
+    // Сбрасывается при любом изменении размеров участка или зданий на нём
+    std::shared_ptr<const SectorSpatialIndex> spatialIndex;
+    // Сводка по участку. Считается при публикации версии и сбрасывается, когда участок берётся на изменение
+    std::shared_ptr<const AreaSummary> summary;
 };
+// Участки разделяются версиями территории: новая версия копирует лишь указатели,
+// а изменяемый участок копируется отдельно (getEditableSector)
 struct Area {
+    static const char* const path;
     int id{};
-    const char* path = "AREA";
-    vector<Sector> children;
+    vector<std::shared_ptr<const Sector>> children;
+};
+
+const char* const Room::path = "AREA/SECTOR/BUILDING/FLOOR/ROOM";
+const vector<string> Room::roomNames = { "bedroom", "kitchen", "bathroom", "restroom", "playroom", "living", "main", "undefined" };
+const char* const Floor::path = "AREA/SECTOR/BUILDING/FLOOR";
+const vector<string> Floor::floorNames = { "first", "second", "third", "undefined" };
+const int Floor::maxRoomCount;
+const char* const Building::path = "AREA/SECTOR/BUILDING";
+const vector<string> Building::buildingNames = { "house", "garage", "shed", "bathHouse", "undefined" };
+const int Building::maxFloorCountForHouse;
+const int Building::minPlacedSize;
+const int Building::maxPlacedSize;
+const char* const Sector::path = "AREA/SECTOR";
+const char* const Area::path = "AREA";
+
+// Сводка по территории: только агрегаты, без ссылок на дочерние элементы.
+// Итоги по всем территориям собираются из сводок и не требуют обхода комнат
+struct AreaSummary {
+    int sectorCount = 0;
+    int buildingCount = 0;
+    int floorCount = 0;
+    int roomCount = 0;
+    int stoveCount = 0;
+    // Сумма площадей всех комнат на всех этажах (не площадь застройки участка)
+    double floorArea = 0;
+    std::array<int, static_cast<int>(BuildingType::undefined) + 1> buildingTypeCounts{};
+    std::array<int, static_cast<int>(RoomType::undefined) + 1> roomTypeCounts{};
+    // Площадь участков с известными размерами и площадь, занятая на них размещёнными зданиями
+    double plotArea = 0;
+    double occupiedArea = 0;
+};
+// Неизменяемая версия территории. Сводка считается один раз при публикации версии
+struct AreaVersion {
+    Area area;
+    AreaSummary summary;
+};
+// Согласованный снимок всех территорий. Неизменённые территории разделяются между снимками
+struct RegionSnapshot {
+    long long version = 0;
+    vector<std::shared_ptr<const AreaVersion>> areas;
+};
+// Читатели берут текущий снимок и дальше работают с ним без блокировок.
+// Писатели готовят новую версию изменённой территории и подменяют снимок
+struct RegionStore {
+    std::shared_ptr<const RegionSnapshot> current = std::make_shared<const RegionSnapshot>();
+    // Номер текущего снимка. По нему читатель без блокировок проверяет, что его снимок ещё актуален
+    std::atomic<long long> version{ 0 };
+    std::mutex writerMutex;
+};
+// Читатель помнит последний взятый снимок и берёт новый, лишь когда сменился номер версии
+struct RegionReader {
+    RegionStore const* store = nullptr;
+    std::shared_ptr<const RegionSnapshot> snapshot;
+};
+
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int length = 0;
+};
+// Равномерная сетка поверх плана участка. Ячейка хранит индексы прямоугольников, которые её задевают:
+// элементы ячейки i лежат в cellItems[cellStarts[i] .. cellStarts[i + 1])
+struct SectorSpatialIndex {
+    int plotWidth = 0;
+    int plotLength = 0;
+    int originX = 0;
+    int originY = 0;
+    int cellSize = 1;
+    int columns = 0;
+    int rows = 0;
+    vector<int> cellStarts;
+    vector<int> cellItems;
+    vector<Rect> rects;
+    vector<int> buildingIds;
+    // Площадь участка под зданиями (м2). Пересечения зданий учитываются один раз
+    double occupiedArea = 0;
+};
+
+enum class DiffKind { added, removed, changed };
+enum class NodeLevel { sector, building, floor, room };
+
+struct FieldChange {
+    string name;
+    int before;
+    int after;
+};
+// Узел определяется цепочкой id: SECTOR/BUILDING/FLOOR/ROOM.
+// Для добавленного узла хранится указатель на его поддерево в новой версии (без копирования)
+struct DiffEntry {
+    DiffKind kind = DiffKind::changed;
+    NodeLevel level = NodeLevel::sector;
+    vector<int> idPath;
+    vector<FieldChange> fields;
+    Sector const* sector = nullptr;
+    Building const* building = nullptr;
+    Floor const* floor = nullptr;
+    Room const* room = nullptr;
+};
+
+// Память одного уровня иерархии: элементы в векторах родителей и неиспользуемый запас ёмкости этих векторов
+struct LevelMemoryUsage {
+    size_t count = 0;
+    size_t nodeBytes = 0;
+    size_t slackBytes = 0;
+};
+// levels индексируется NodeLevel. sharedStringBytes - общие для всех элементов таблицы названий типов.
+// areaBytes - версии территорий (AreaVersion со сводкой и счётчиком ссылок), каждая учитывается один раз.
+// snapshotBytes - сам снимок и его вектор указателей на версии
+struct MemoryReport {
+    size_t areaCount = 0;
+    size_t areaBytes = 0;
+    std::array<LevelMemoryUsage, 4> levels;
+    size_t spatialIndexCount = 0;
+    size_t spatialIndexBytes = 0;
+    size_t snapshotBytes = 0;
+    size_t sharedStringBytes = 0;
+};
+
+// Префиксное дерево словаря. Узел хранит слово, которое в нём заканчивается,
+// и все слова с этим префиксом, поэтому уникальный префикс находится за один проход по строке
+struct WordResolverNode {
+    vector<std::pair<char, int>> next;
+    int word = -1;
+    vector<int> words;
+};
+struct WordResolver {
+    vector<string> words;
+    vector<WordResolverNode> nodes;
+};
+
+// Порядок совпадает со словарём getCommandResolver
+enum class MenuCommand { add, edit, about, exit, summary, snapshot, diff, revert, memory, compact };
+enum class ScriptVerb { add, edit, about, exit };
+enum class ScriptKey { type, plotWidth, plotLength, stove, placed, x, y, width, length, height };
+
+// Команда сценария, разобранная один раз: типы и значения уже преобразованы в числа.
+// Свойства хранятся как FieldChange и применяются так же, как изменения из diff
+struct ScriptCommand {
+    // Место в сценарии для сообщений: номер команды, а для многострочного сценария и номер строки
+    string position;
+    ScriptVerb verb = ScriptVerb::about;
+    NodeLevel level = NodeLevel::sector;
+    int id = -1;
+    int type = -1;
+    vector<FieldChange> properties;
+};
+// key - имя в сценарии, field - имя поля для applyFieldChange
+struct ScriptProperty {
+    NodeLevel level;
+    ScriptKey key;
+    const char* field;
+    int min;
+    int max;
+};
+// Текущая позиция в иерархии: add/edit спускаются на уровень, exit поднимается
+struct ScriptCursor {
+    Sector* sector = nullptr;
+    Building* building = nullptr;
+    Floor* floor = nullptr;
+};
+// Клиент сервера: принятые, но ещё не разобранные байты и не отправленный ответ
+struct ServerClient {
+    // Уникален за время работы сервера, в отличие от fd, который может достаться новому клиенту
+    long long id = 0;
+    int fd = -1;
+    string input;
+    string output;
+    // Клиент закрыл свою сторону: запросов больше не будет, но ответы ещё нужно дописать
+    bool isReadClosed = false;
+    // Запрос чтения выполняется в потоке читателя. Следующие запросы ждут, чтобы ответы шли по порядку
+    bool isWaiting = false;
+    bool isClosed = false;
+};
+// Запрос чтения для потока читателя и готовый ответ на него
+struct ServerReadTask {
+    long long clientId;
+    string requestName;
+    string response;
+};
+// Поток читателя выполняет запросы чтения по снимкам параллельно с основным потоком сервера,
+// который выполняет изменения. Готовые ответы основной поток забирает, когда его разбудит запись в wakePipe
+struct ServerReader {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<ServerReadTask> tasks;
+    vector<ServerReadTask> results;
+    bool isStopped = false;
+    int wakePipe[2] = { -1, -1 };
 };
 
 // --- --- --- --- ---
@@ -130,21 +366,168 @@ void outputListToStream(std::ostream &out, std::vector<std::string> const &list,
     out << std::endl;
 }
 
-int selectFromList(std::vector<std::string> const &list) {
-    bool isList = list.size() > 1;
+const int WORD_NOT_FOUND = -1;
+const int WORD_AMBIGUOUS = -2;
+const char* const AMBIGUOUS_WORD_MESSAGE = "Неоднозначно. Введите больше букв!";
+
+char getLowerChar(char c) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+// Строится один раз на словарь. Индекс слова совпадает с его индексом в words
+WordResolver getWordResolver(vector<string> const &words) {
+    WordResolver resolver;
+    resolver.words = words;
+    resolver.nodes.emplace_back();
+
+    for (int word = 0; word < words.size(); ++word) {
+        int node = 0;
+        resolver.nodes[node].words.push_back(word);
+
+        for (char c : words[word]) {
+            c = getLowerChar(c);
+            auto const &next = resolver.nodes[node].next;
+            auto it = std::find_if(next.begin(), next.end(), [c](std::pair<char, int> const &n) { return n.first == c; });
+
+            if (it != next.end()) {
+                node = it->second;
+            }
+            else {
+                resolver.nodes.emplace_back();
+                int child = static_cast<int>(resolver.nodes.size()) - 1;
+                resolver.nodes[node].next.emplace_back(c, child);
+                node = child;
+            }
+            resolver.nodes[node].words.push_back(word);
+        }
+
+        resolver.nodes[node].word = word;
+    }
+
+    return resolver;
+}
+
+// Без учёта регистра. Точное совпадение важнее префикса. isAllowed(word) ограничивает выбор,
+// например, пунктами текущего меню. Возвращает индекс слова, WORD_NOT_FOUND или WORD_AMBIGUOUS
+template<class F>
+int resolveWord(WordResolver const &resolver, string const &input, F isAllowed) {
+    if (input.empty()) return WORD_NOT_FOUND;
+
+    int node = 0;
+    for (char c : input) {
+        c = getLowerChar(c);
+        auto const &next = resolver.nodes[node].next;
+        auto it = std::find_if(next.begin(), next.end(), [c](std::pair<char, int> const &n) { return n.first == c; });
+        if (it == next.end()) return WORD_NOT_FOUND;
+        node = it->second;
+    }
+
+    auto const &found = resolver.nodes[node];
+    if (found.word >= 0 && isAllowed(found.word)) return found.word;
+
+    int result = WORD_NOT_FOUND;
+    for (int word : found.words) {
+        if (!isAllowed(word)) continue;
+        if (result != WORD_NOT_FOUND) return WORD_AMBIGUOUS;
+        result = word;
+    }
+
+    return result;
+}
+
+int resolveWord(WordResolver const &resolver, string const &input) {
+    return resolveWord(resolver, input, [](int) { return true; });
+}
+
+// Словари строятся один раз при первом обращении
+
+// Порядок слов совпадает с MenuCommand
+WordResolver const &getCommandResolver() {
+    static const WordResolver resolver = getWordResolver({ "add", "edit", "about", "exit", "summary", "snapshot", "diff", "revert", "memory", "compact" });
+    return resolver;
+}
+
+WordResolver const &getAnswerResolver() {
+    static const WordResolver resolver = getWordResolver({ "yes", "no" });
+    return resolver;
+}
+
+WordResolver const &getLevelResolver() {
+    static const WordResolver resolver = getWordResolver({ "sector", "building", "floor", "room" });
+    return resolver;
+}
+
+WordResolver const &getTypeResolver(NodeLevel level) {
+    static const WordResolver buildingResolver = getWordResolver(Building::buildingNames);
+    static const WordResolver floorResolver = getWordResolver(Floor::floorNames);
+    static const WordResolver roomResolver = getWordResolver(Room::roomNames);
+
+    if (level == NodeLevel::building) return buildingResolver;
+    if (level == NodeLevel::floor) return floorResolver;
+
+    return roomResolver;
+}
+
+// Порядок слов совпадает с ScriptVerb
+WordResolver const &getScriptVerbResolver() {
+    static const WordResolver resolver = getWordResolver({ "add", "edit", "about", "exit" });
+    return resolver;
+}
+
+// Порядок слов совпадает с ScriptKey
+WordResolver const &getScriptKeyResolver() {
+    static const WordResolver resolver = getWordResolver({ "type", "plotWidth", "plotLength", "stove", "placed", "x", "y", "width", "length", "height" });
+    return resolver;
+}
+
+WordResolver const &getServerRequestResolver() {
+    static const WordResolver resolver = getWordResolver({ "summary", "about", "script", "memory", "compact", "shutdown" });
+    return resolver;
+}
+
+// allowed - индексы слов словаря, которые можно выбрать. Возвращает индекс выбранного слова
+int selectWord(WordResolver const &resolver, vector<int> const &allowed) {
+    bool isList = allowed.size() > 1;
+    auto isAllowed = [&allowed](int word) { return isIncludes(allowed, word); };
 
     while (true) {
         cout << (isList ? "Выберите одну из опций: " : "Введите команду : ");
-        outputListToStream(std::cout, list, (isList ? "|" : ""));
+        for (int i = 0; i < allowed.size(); ++i) cout << resolver.words[allowed[i]] << (i != allowed.size() - 1 && isList ? "|" : "");
+        cout << endl;
 
         auto userInput = getUserLineString();
-        // return index from list, if word found
-        for (int i = 0; i < list.size(); ++i) if (list[i] == userInput) return i;
+        // Достаточно уникального префикса в любом регистре
+        auto word = resolveWord(resolver, userInput, isAllowed);
+        if (word >= 0) return word;
 
-        cout << "Неверно. Попробуйте снова!" << endl;
+        cout << (word == WORD_AMBIGUOUS ? AMBIGUOUS_WORD_MESSAGE : "Неверно. Попробуйте снова!") << endl;
     }
 }
 
+// Ошибка разбора слова вне меню (сценарий, запрос сервера). notFoundError - текст для неизвестного слова
+string getWordError(int word, string const &notFoundError, string const &token) {
+    if (word == WORD_AMBIGUOUS) return token + ": " + AMBIGUOUS_WORD_MESSAGE;
+    return notFoundError + token;
+}
+
+// Пункты меню - индексы слов словаря команд. Список строится при входе в меню, а не на каждый выбор
+vector<int> getMenuCommands(std::initializer_list<MenuCommand> commands) {
+    vector<int> words;
+    words.reserve(commands.size());
+    for (auto command : commands) words.push_back(static_cast<int>(command));
+
+    return words;
+}
+
+MenuCommand selectMenuCommand(vector<int> const &commands) {
+    return static_cast<MenuCommand>(selectWord(getCommandResolver(), commands));
+}
+
+bool selectYesOrNo() {
+    static const vector<int> answers = { 0, 1 };
+    return selectWord(getAnswerResolver(), answers) == 0;
+}
+
 template<typename T>
 std::string getDelimitedString(T const &list, char const delim = ',') {
     std::string delimitedString;
@@ -235,12 +618,42 @@ int getAvailableIndexInRange(vector<int> const &range) {
     return current;
 }
 
+// Дочерние элементы хранятся по значению, участки - через shared_ptr.
+// Обобщённый код обращается к ним одинаково
+template <class T>
+T const &getNode(T const &child) { return child; }
+
+template <class T>
+T const &getNode(std::shared_ptr<const T> const &child) { return *child; }
+
+// Участок для изменения. Опубликованный участок разделяется версиями и не меняется, поэтому изменяется копия.
+// Копия, уже созданная этой правкой, принадлежит ей одной и меняется на месте.
+// Сводка участка сбрасывается и пересчитывается при публикации
+Sector &getEditableSector(std::shared_ptr<const Sector> &sector) {
+    if (sector.use_count() != 1) sector = std::make_shared<Sector>(*sector);
+    // Все участки создаются через make_shared<Sector>, т.е. объект неконстантный, и других ссылок на него нет
+    auto &editable = const_cast<Sector &>(*sector);
+    editable.summary.reset();
+    return editable;
+}
+
+// Для обобщённого кода слияния
+template <class T>
+T &getEditableNode(T &child) { return child; }
+
+Sector &getEditableNode(std::shared_ptr<const Sector> &sector) { return getEditableSector(sector); }
+
+template <class T>
+void addChild(vector<T> &children, T const &child) { children.push_back(child); }
+
+void addChild(vector<std::shared_ptr<const Sector>> &children, Sector const &child) { children.push_back(std::make_shared<Sector>(child)); }
+
 // T -> struct of Room|Floor|Building|Sector
 template <class T>
 int getAvailableIndexInChildren(vector<T> const &children) {
     vector<int> range;
     range.reserve(children.size());
-    for (auto const &child : children) range.push_back(child.id);
+    for (auto const &child : children) range.push_back(getNode(child).id);
 
     return getAvailableIndexInRange(range);
 }
@@ -257,8 +670,8 @@ int getAvailableIndexInBuildings(vector<Building> const &buildings) {
     return getAvailableIndexInChildren<Building>(buildings);
 }
 
-int getAvailableIndexInSectors(vector<Sector> const &sectors) {
-    return getAvailableIndexInChildren<Sector>(sectors);
+int getAvailableIndexInSectors(vector<std::shared_ptr<const Sector>> const &sectors) {
+    return getAvailableIndexInChildren(sectors);
 }
 
 double getRoomFootprint(Room const &room) {
@@ -266,86 +679,1012 @@ double getRoomFootprint(Room const &room) {
 }
 
 double getFloorFootprint(Floor const &floor) {
-    double footprint;
+    double footprint = 0;
     for (auto const &room : floor.children)
         footprint += getRoomFootprint(room);
 
     return footprint;
 }
 
-double getBuildingFootprint(Building const &building) {
-    double footprint;
-    for (auto const &floor : building.children) {
-        for (auto const &room : floor.children)
-            footprint += getRoomFootprint(room);
-    }
+double getBuildingFootprint(Building const &building) {
+    double footprint = 0;
+    for (auto const &floor : building.children) {
+        for (auto const &room : floor.children)
+            footprint += getRoomFootprint(room);
+    }
+
+    return footprint;
+}
+
+// --- --- --- --- --- ---
+
+Rect getBuildingRect(Building const &building) {
+    return { building.x, building.y, building.width, building.length };
+}
+
+bool isRectsOverlap(Rect const &a, Rect const &b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.length && b.y < a.y + a.length;
+}
+
+bool isRectInsidePlot(Rect const &rect, int plotWidth, int plotLength) {
+    return rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= plotWidth && rect.y + rect.length <= plotLength;
+}
+
+// Пустое пересечение - прямоугольник нулевой площади
+Rect getRectIntersection(Rect const &a, Rect const &b) {
+    int x = std::max(a.x, b.x);
+    int y = std::max(a.y, b.y);
+    int width = std::min(a.x + a.width, b.x + b.width) - x;
+    int length = std::min(a.y + a.length, b.y + b.length) - y;
+
+    return { x, y, std::max(0, width), std::max(0, length) };
+}
+
+// Площадь объединения прямоугольников (мм2). Сжатие координат за O(n^3) - лишь для нескольких прямоугольников
+long long getRectsUnionArea(vector<Rect> const &rects) {
+    vector<int> xs;
+    vector<int> ys;
+    for (auto const &rect : rects) {
+        xs.push_back(rect.x);
+        xs.push_back(rect.x + rect.width);
+        ys.push_back(rect.y);
+        ys.push_back(rect.y + rect.length);
+    }
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    long long area = 0;
+    for (int i = 0; i + 1 < xs.size(); ++i) {
+        for (int j = 0; j + 1 < ys.size(); ++j) {
+            bool isCovered = std::any_of(rects.begin(), rects.end(), [&](Rect const &rect) {
+                return rect.x <= xs[i] && xs[i + 1] <= rect.x + rect.width && rect.y <= ys[j] && ys[j + 1] <= rect.y + rect.length;
+            });
+            if (isCovered) area += static_cast<long long>(xs[i + 1] - xs[i]) * (ys[j + 1] - ys[j]);
+        }
+    }
+
+    return area;
+}
+
+int getCellColumn(SectorSpatialIndex const &index, int x) {
+    return std::max(0, std::min(index.columns - 1, (x - index.originX) / index.cellSize));
+}
+
+int getCellRow(SectorSpatialIndex const &index, int y) {
+    return std::max(0, std::min(index.rows - 1, (y - index.originY) / index.cellSize));
+}
+
+// Вызывает callback(cellIndex) для каждой ячейки, которую задевает прямоугольник
+template<class F>
+void forEachCoveredCell(SectorSpatialIndex const &index, Rect const &rect, F callback) {
+    int firstColumn = getCellColumn(index, rect.x);
+    int lastColumn = getCellColumn(index, rect.x + std::max(rect.width, 1) - 1);
+    int firstRow = getCellRow(index, rect.y);
+    int lastRow = getCellRow(index, rect.y + std::max(rect.length, 1) - 1);
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) callback(row * index.columns + column);
+    }
+}
+
+// Индекс строится целиком за два прохода: подсчёт элементов в ячейках и раскладка по ячейкам.
+// Размер ячейки - средний габарит здания, поэтому в ячейку попадает лишь несколько зданий
+SectorSpatialIndex buildSectorSpatialIndex(Sector const &sector) {
+    SectorSpatialIndex index;
+    index.plotWidth = sector.plotWidth;
+    index.plotLength = sector.plotLength;
+
+    long long extentSum = 0;
+    int minX = 0;
+    int minY = 0;
+    int maxX = sector.plotWidth;
+    int maxY = sector.plotLength;
+    for (auto const &building : sector.children) {
+        if (!building.isPlaced) continue;
+        auto rect = getBuildingRect(building);
+        index.rects.push_back(rect);
+        index.buildingIds.push_back(building.id);
+        extentSum += std::max(1, std::max(rect.width, rect.length));
+        minX = std::min(minX, rect.x);
+        minY = std::min(minY, rect.y);
+        maxX = std::max(maxX, rect.x + rect.width);
+        maxY = std::max(maxY, rect.y + rect.length);
+    }
+
+    if (index.rects.empty()) return index;
+
+    long long count = static_cast<long long>(index.rects.size());
+    index.originX = minX;
+    index.originY = minY;
+    index.cellSize = static_cast<int>(std::max(1LL, extentSum / count));
+    // Ограничиваем число ячеек, чтобы пустые участки не раздували сетку
+    while (true) {
+        index.columns = (maxX - minX) / index.cellSize + 1;
+        index.rows = (maxY - minY) / index.cellSize + 1;
+        if (static_cast<long long>(index.columns) * index.rows <= 4 * count + 64) break;
+        index.cellSize *= 2;
+    }
+
+    index.cellStarts.assign(index.columns * index.rows + 1, 0);
+    for (auto const &rect : index.rects) {
+        forEachCoveredCell(index, rect, [&index](int cell) { ++index.cellStarts[cell + 1]; });
+    }
+    for (int i = 1; i < index.cellStarts.size(); ++i) index.cellStarts[i] += index.cellStarts[i - 1];
+
+    index.cellItems.resize(index.cellStarts.back());
+    vector<int> cellFill(index.cellStarts.begin(), index.cellStarts.end() - 1);
+    for (int i = 0; i < index.rects.size(); ++i) {
+        forEachCoveredCell(index, index.rects[i], [&index, &cellFill, i](int cell) { index.cellItems[cellFill[cell]++] = i; });
+    }
+
+    // Ячейки не пересекаются, поэтому объединение зданий считается по ячейкам:
+    // в каждой лишь несколько зданий, обрезанных по ячейке и по участку
+    if (index.plotWidth > 0 && index.plotLength > 0) {
+        Rect plot = { 0, 0, index.plotWidth, index.plotLength };
+        long long occupiedArea = 0;
+        vector<Rect> cellRects;
+        for (int row = 0; row < index.rows; ++row) {
+            for (int column = 0; column < index.columns; ++column) {
+                int cell = row * index.columns + column;
+                Rect cellRect = { index.originX + column * index.cellSize, index.originY + row * index.cellSize, index.cellSize, index.cellSize };
+                auto bounds = getRectIntersection(cellRect, plot);
+
+                cellRects.clear();
+                for (int i = index.cellStarts[cell]; i < index.cellStarts[cell + 1]; ++i) {
+                    auto clipped = getRectIntersection(index.rects[index.cellItems[i]], bounds);
+                    if (clipped.width > 0 && clipped.length > 0) cellRects.push_back(clipped);
+                }
+                occupiedArea += getRectsUnionArea(cellRects);
+            }
+        }
+        index.occupiedArea = static_cast<double>(occupiedArea) / 1000000;
+    }
+
+    return index;
+}
+
+// Сохранённый план опубликованной версии или временный для ещё не опубликованной копии участка
+std::shared_ptr<const SectorSpatialIndex> getSectorSpatialIndex(Sector const &sector) {
+    if (sector.spatialIndex) return sector.spatialIndex;
+
+    return std::make_shared<const SectorSpatialIndex>(buildSectorSpatialIndex(sector));
+}
+
+// Пары id пересекающихся зданий. Пара учитывается лишь в той ячейке,
+// где лежит левый верхний угол пересечения, поэтому повторов нет
+vector<std::pair<int, int>> getOverlappingBuildings(SectorSpatialIndex const &index) {
+    vector<std::pair<int, int>> overlaps;
+
+    for (int cell = 0; cell + 1 < index.cellStarts.size(); ++cell) {
+        for (int i = index.cellStarts[cell]; i < index.cellStarts[cell + 1]; ++i) {
+            for (int j = i + 1; j < index.cellStarts[cell + 1]; ++j) {
+                auto const &a = index.rects[index.cellItems[i]];
+                auto const &b = index.rects[index.cellItems[j]];
+                if (!isRectsOverlap(a, b)) continue;
+
+                int cornerCell = getCellRow(index, std::max(a.y, b.y)) * index.columns + getCellColumn(index, std::max(a.x, b.x));
+                if (cornerCell != cell) continue;
+
+                overlaps.emplace_back(index.buildingIds[index.cellItems[i]], index.buildingIds[index.cellItems[j]]);
+            }
+        }
+    }
+
+    return overlaps;
+}
+
+// Свободно ли место на участке. excludedBuildingId - здание, которое не учитывается (например, перемещаемое)
+bool isFreeSpace(SectorSpatialIndex const &index, Rect const &rect, int excludedBuildingId = -1) {
+    bool isPlot = index.plotWidth > 0 && index.plotLength > 0;
+    if (isPlot && !isRectInsidePlot(rect, index.plotWidth, index.plotLength)) return false;
+    if (index.rects.empty()) return true;
+
+    bool isFree = true;
+    forEachCoveredCell(index, rect, [&](int cell) {
+        for (int i = index.cellStarts[cell]; isFree && i < index.cellStarts[cell + 1]; ++i) {
+            int item = index.cellItems[i];
+            if (index.buildingIds[item] != excludedBuildingId && isRectsOverlap(rect, index.rects[item])) isFree = false;
+        }
+    });
+
+    return isFree;
+}
+
+double getPlotArea(Sector const &sector) {
+    return static_cast<double>(static_cast<long long>(sector.plotWidth) * sector.plotLength) / 1000000;
+}
+
+void showSectorLayout(std::ostream &out, Sector const &sector) {
+    auto indexPointer = getSectorSpatialIndex(sector);
+    auto const &index = *indexPointer;
+    double plotArea = getPlotArea(sector);
+
+    out << sector.path << ": план участка:" << endl;
+    if (plotArea > 0) {
+        out << "Размеры участка ------------ : " << sector.plotWidth << " x " << sector.plotLength << endl;
+        out << "Занято зданиями (м2) ------- : " << std::fixed << std::setprecision(2) << index.occupiedArea
+            << " (" << index.occupiedArea * 100 / plotArea << "%)" << endl;
+
+        for (int i = 0; i < index.rects.size(); ++i) {
+            if (!isRectInsidePlot(index.rects[i], sector.plotWidth, sector.plotLength))
+                out << "Внимание: здание id " << index.buildingIds[i] << " выходит за границы участка" << endl;
+        }
+    }
+    else {
+        out << "Размеры участка не заданы" << endl;
+    }
+
+    for (auto const &overlap : getOverlappingBuildings(index)) {
+        out << "Внимание: здания id " << overlap.first << " и id " << overlap.second << " пересекаются" << endl;
+    }
+    out << endl;
+}
+
+
+void showRoom(std::ostream &out, Room const &room) {
+    out << room.path << ": информация:" << endl;
+    out << "            Комната id ----- : " << room.id << endl;
+    out << "            Тип ------------ : " << room.roomNames[static_cast<int>(room.type)] << endl;
+    out << "            Ширина --------- : " << room.width << endl;
+    out << "            Длина ---------- : " << room.length << endl;
+    out << "            Площадь (м2) --- : " << std::fixed << std::setprecision(2) << getRoomFootprint(room) << endl;
+    out << endl;
+}
+
+void showFloor(std::ostream &out, Floor const &floor, bool isFullInfo = true) {
+    out << floor.path << ": информация:" << endl;
+    out << "        Этаж id ------------ : " << floor.id << endl;
+    out << "        Тип ---------------- : " << floor.floorNames[static_cast<int>(floor.type)] << endl;
+    out << "        Высота ------------- : " << floor.height << endl;
+    out << "        Количество комнат -- : " << floor.children.size() << endl;
+    out << "        Площадь этажа (м2) - : " << std::fixed << std::setprecision(2) << getFloorFootprint(floor) << endl;
+    out << endl;
+
+    if (!floor.children.empty() && isFullInfo) {
+        for (auto const &room : floor.children) {
+            showRoom(out, room);
+            out << "-----------------------------" << endl;
+        }
+    }
+}
+
+void showBuilding(std::ostream &out, Building const &building, bool isFullInfo = true) {
+    out << building.path << ": информация:" << endl;
+    out << "    Здание id -------------- : " << building.id << endl;
+    out << "    Тип -------------------- : " << building.buildingNames[static_cast<int>(building.type)] << endl;
+    out << "    Наличие печи ----------- : " << (building.isStove ? "Есть" : "Нет") << endl;
+    out << "    Количество этажей ------ : " << building.children.size() << endl;
+    out << "    Площадь дома (м2) ------ : " << std::fixed << std::setprecision(2) << getBuildingFootprint(building) << endl;
+    if (building.isPlaced) {
+        out << "    Расположение (x, y) ---- : " << building.x << ", " << building.y << endl;
+        out << "    Габариты --------------- : " << building.width << " x " << building.length << endl;
+    }
+    out << endl;
+
+    if (!building.children.empty() && isFullInfo) {
+        for (auto const &floor : building.children) {
+            showFloor(out, floor);
+            out << "-----------------------------" << endl;
+        }
+    }
+}
+
+void showSector(std::ostream &out, Sector const &sector, bool isFullInfo = true) {
+    out << sector.path << ": информация:" << endl;
+    out << "Сектор id ------------------ :" << sector.id << endl;
+    out << "Количество зданий ---------- :" << sector.children.size() << endl;
+    out << endl;
+    showSectorLayout(out, sector);
+
+    if (!sector.children.empty() && isFullInfo) {
+        for (auto const &building : sector.children) {
+            showBuilding(out, building);
+            out << "-----------------------------" << endl;
+        }
+    }
+}
+
+void showExistingSectors(std::ostream &out, vector<std::shared_ptr<const Sector>> const &sectors) {
+    if (!sectors.empty()) {
+        for (auto const &sector : sectors) showSector(out, *sector);
+    }
+}
+
+// --- --- --- --- --- ---
+
+// Полный обход участка. Вызывается лишь для участков, изменённых с прошлой версии
+AreaSummary getSectorSummary(Sector const &sector) {
+    AreaSummary summary;
+    summary.sectorCount = 1;
+
+    // Занятость считается лишь на участках с известными размерами
+    double plotArea = getPlotArea(sector);
+    if (plotArea > 0) {
+        summary.plotArea += plotArea;
+        summary.occupiedArea += getSectorSpatialIndex(sector)->occupiedArea;
+    }
+
+    for (auto const &building : sector.children) {
+        ++summary.buildingCount;
+        ++summary.buildingTypeCounts[static_cast<int>(building.type)];
+        if (building.isStove) ++summary.stoveCount;
+        summary.floorArea += getBuildingFootprint(building);
+
+        for (auto const &floor : building.children) {
+            ++summary.floorCount;
+            for (auto const &room : floor.children) {
+                ++summary.roomCount;
+                ++summary.roomTypeCounts[static_cast<int>(room.type)];
+            }
+        }
+    }
+
+    return summary;
+}
+
+void addToSummary(AreaSummary &total, AreaSummary const &summary);
+
+// Сводка территории складывается из сводок участков без обхода зданий и комнат
+AreaSummary getAreaSummary(Area const &area) {
+    AreaSummary summary;
+    for (auto const &sector : area.children) addToSummary(summary, sector->summary ? *sector->summary : getSectorSummary(*sector));
+    return summary;
+}
+
+void addToSummary(AreaSummary &total, AreaSummary const &summary) {
+    total.sectorCount += summary.sectorCount;
+    total.buildingCount += summary.buildingCount;
+    total.floorCount += summary.floorCount;
+    total.roomCount += summary.roomCount;
+    total.stoveCount += summary.stoveCount;
+    total.floorArea += summary.floorArea;
+    total.plotArea += summary.plotArea;
+    total.occupiedArea += summary.occupiedArea;
+    for (int i = 0; i < total.buildingTypeCounts.size(); ++i) total.buildingTypeCounts[i] += summary.buildingTypeCounts[i];
+    for (int i = 0; i < total.roomTypeCounts.size(); ++i) total.roomTypeCounts[i] += summary.roomTypeCounts[i];
+}
+
+AreaSummary getRegionSummary(RegionSnapshot const &snapshot) {
+    AreaSummary total;
+    for (auto const &areaVersion : snapshot.areas) addToSummary(total, areaVersion->summary);
+
+    return total;
+}
+
+void showRegionSummary(std::ostream &out, RegionSnapshot const &snapshot) {
+    auto total = getRegionSummary(snapshot);
+    out << "REGION: сводная информация:" << endl;
+    out << "Территорий ----------------- : " << snapshot.areas.size() << endl;
+    out << "Участков ------------------- : " << total.sectorCount << endl;
+    out << "Зданий --------------------- : " << total.buildingCount << endl;
+    out << "Этажей --------------------- : " << total.floorCount << endl;
+    out << "Комнат --------------------- : " << total.roomCount << endl;
+    out << "Зданий с печью ------------- : " << total.stoveCount << endl;
+    out << "Площадь помещений (м2) ----- : " << std::fixed << std::setprecision(2) << total.floorArea << endl;
+    if (total.plotArea > 0) {
+        out << "Площадь участков (м2) ------ : " << total.plotArea << endl;
+        out << "Занято зданиями (%) -------- : " << total.occupiedArea * 100 / total.plotArea << endl;
+    }
+
+    out << "Здания по типам:" << endl;
+    for (int i = 0; i < total.buildingTypeCounts.size(); ++i) {
+        if (total.buildingTypeCounts[i]) out << "    " << Building::buildingNames[i] << " : " << total.buildingTypeCounts[i] << endl;
+    }
+
+    out << "Комнаты по типам:" << endl;
+    for (int i = 0; i < total.roomTypeCounts.size(); ++i) {
+        if (total.roomTypeCounts[i]) out << "    " << Room::roomNames[i] << " : " << total.roomTypeCounts[i] << endl;
+    }
+
+    // Доля каждой территории в общей площади помещений
+    out << "Доля площади помещений по территориям:" << endl;
+    for (auto const &areaVersion : snapshot.areas) {
+        auto const &summary = areaVersion->summary;
+        double share = total.floorArea > 0 ? summary.floorArea * 100 / total.floorArea : 0;
+        out << "    Территория id " << areaVersion->area.id << " : " << std::fixed << std::setprecision(2)
+            << summary.floorArea << " м2 (" << share << "%)" << endl;
+    }
+    out << endl;
+}
+
+// --- --- --- --- --- ---
+
+NodeLevel getNodeLevel(Sector const &) { return NodeLevel::sector; }
+NodeLevel getNodeLevel(Building const &) { return NodeLevel::building; }
+NodeLevel getNodeLevel(Floor const &) { return NodeLevel::floor; }
+NodeLevel getNodeLevel(Room const &) { return NodeLevel::room; }
+
+void setDiffSource(DiffEntry &entry, Sector const &sector) { entry.sector = &sector; }
+void setDiffSource(DiffEntry &entry, Building const &building) { entry.building = &building; }
+void setDiffSource(DiffEntry &entry, Floor const &floor) { entry.floor = &floor; }
+void setDiffSource(DiffEntry &entry, Room const &room) { entry.room = &room; }
+
+void addFieldChange(vector<FieldChange> &fields, string const &name, int before, int after) {
+    if (before != after) fields.push_back({ name, before, after });
+}
+
+vector<FieldChange> getFieldChanges(Sector const &before, Sector const &after) {
+    vector<FieldChange> fields;
+    addFieldChange(fields, "plotWidth", before.plotWidth, after.plotWidth);
+    addFieldChange(fields, "plotLength", before.plotLength, after.plotLength);
+
+    return fields;
+}
+
+vector<FieldChange> getFieldChanges(Building const &before, Building const &after) {
+    vector<FieldChange> fields;
+    addFieldChange(fields, "type", static_cast<int>(before.type), static_cast<int>(after.type));
+    addFieldChange(fields, "isStove", before.isStove, after.isStove);
+    addFieldChange(fields, "isPlaced", before.isPlaced, after.isPlaced);
+    addFieldChange(fields, "x", before.x, after.x);
+    addFieldChange(fields, "y", before.y, after.y);
+    addFieldChange(fields, "width", before.width, after.width);
+    addFieldChange(fields, "length", before.length, after.length);
+
+    return fields;
+}
+
+vector<FieldChange> getFieldChanges(Floor const &before, Floor const &after) {
+    vector<FieldChange> fields;
+    addFieldChange(fields, "type", static_cast<int>(before.type), static_cast<int>(after.type));
+    addFieldChange(fields, "height", before.height, after.height);
+
+    return fields;
+}
+
+vector<FieldChange> getFieldChanges(Room const &before, Room const &after) {
+    vector<FieldChange> fields;
+    addFieldChange(fields, "type", static_cast<int>(before.type), static_cast<int>(after.type));
+    addFieldChange(fields, "width", before.width, after.width);
+    addFieldChange(fields, "length", before.length, after.length);
+
+    return fields;
+}
+
+// T -> struct of Room|Floor|Building|Sector
+template<class T>
+void addDiffEntry(vector<DiffEntry> &diff, DiffKind kind, T const &node, vector<int> const &idPath, vector<FieldChange> fields = {}) {
+    DiffEntry entry;
+    entry.kind = kind;
+    entry.level = getNodeLevel(node);
+    entry.idPath = idPath;
+    entry.fields = std::move(fields);
+    if (kind == DiffKind::added) setDiffSource(entry, node);
+
+    diff.emplace_back(std::move(entry));
+}
+
+// Новые id выдаются по порядку, поэтому дочерние элементы обычно уже упорядочены и сортировка не нужна.
+// Сортируются лишь указатели: само дерево не копируется
+template<class C>
+auto getChildrenSortedById(vector<C> const &children) {
+    using T = typename std::decay<decltype(getNode(children.front()))>::type;
+    vector<T const*> sorted;
+    sorted.reserve(children.size());
+    for (auto const &child : children) sorted.push_back(&getNode(child));
+
+    auto isLess = [](T const* a, T const* b) { return a->id < b->id; };
+    if (!std::is_sorted(sorted.begin(), sorted.end(), isLess)) std::sort(sorted.begin(), sorted.end(), isLess);
+
+    return sorted;
+}
+
+void diffNode(Sector const &before, Sector const &after, vector<int> &idPath, vector<DiffEntry> &diff);
+void diffNode(Building const &before, Building const &after, vector<int> &idPath, vector<DiffEntry> &diff);
+void diffNode(Floor const &before, Floor const &after, vector<int> &idPath, vector<DiffEntry> &diff);
+void diffNode(Room const &before, Room const &after, vector<int> &idPath, vector<DiffEntry> &diff);
+
+// Слияние двух упорядоченных по id списков за один проход
+template<class C>
+void diffChildren(vector<C> const &before, vector<C> const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    auto sortedBefore = getChildrenSortedById(before);
+    auto sortedAfter = getChildrenSortedById(after);
+
+    int i = 0;
+    int j = 0;
+    while (i < sortedBefore.size() || j < sortedAfter.size()) {
+        bool isRemoved = j == sortedAfter.size() || (i < sortedBefore.size() && sortedBefore[i]->id < sortedAfter[j]->id);
+        bool isAdded = !isRemoved && (i == sortedBefore.size() || sortedAfter[j]->id < sortedBefore[i]->id);
+
+        if (isRemoved) {
+            idPath.push_back(sortedBefore[i]->id);
+            addDiffEntry(diff, DiffKind::removed, *sortedBefore[i], idPath);
+            ++i;
+        }
+        else if (isAdded) {
+            idPath.push_back(sortedAfter[j]->id);
+            addDiffEntry(diff, DiffKind::added, *sortedAfter[j], idPath);
+            ++j;
+        }
+        else {
+            idPath.push_back(sortedAfter[j]->id);
+            // Участок, общий для обеих версий, не изменился
+            if (sortedBefore[i] != sortedAfter[j]) diffNode(*sortedBefore[i], *sortedAfter[j], idPath, diff);
+            ++i;
+            ++j;
+        }
+
+        idPath.pop_back();
+    }
+}
+
+// T -> struct of Room|Floor|Building|Sector
+template<class T>
+void diffNodeFields(T const &before, T const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    auto fields = getFieldChanges(before, after);
+    if (!fields.empty()) addDiffEntry(diff, DiffKind::changed, after, idPath, std::move(fields));
+}
+
+void diffNode(Sector const &before, Sector const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    diffNodeFields(before, after, idPath, diff);
+    diffChildren(before.children, after.children, idPath, diff);
+}
+
+void diffNode(Building const &before, Building const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    diffNodeFields(before, after, idPath, diff);
+    diffChildren(before.children, after.children, idPath, diff);
+}
+
+void diffNode(Floor const &before, Floor const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    diffNodeFields(before, after, idPath, diff);
+    diffChildren(before.children, after.children, idPath, diff);
+}
+
+void diffNode(Room const &before, Room const &after, vector<int> &idPath, vector<DiffEntry> &diff) {
+    diffNodeFields(before, after, idPath, diff);
+}
+
+// Изменения упорядочены от родителя к потомкам: добавленные и удалённые поддеревья не раскрываются
+vector<DiffEntry> getAreaDiff(Area const &before, Area const &after) {
+    vector<DiffEntry> diff;
+    vector<int> idPath;
+    diffChildren(before.children, after.children, idPath, diff);
+
+    return diff;
+}
+
+void applyFieldChange(Sector &sector, FieldChange const &change) {
+    sector.spatialIndex.reset();
+    if (change.name == "plotWidth") sector.plotWidth = change.after;
+    else if (change.name == "plotLength") sector.plotLength = change.after;
+}
+
+void applyFieldChange(Building &building, FieldChange const &change) {
+    if (change.name == "type") building.type = static_cast<BuildingType>(change.after);
+    else if (change.name == "isStove") building.isStove = change.after != 0;
+    else if (change.name == "isPlaced") building.isPlaced = change.after != 0;
+    else if (change.name == "x") building.x = change.after;
+    else if (change.name == "y") building.y = change.after;
+    else if (change.name == "width") building.width = change.after;
+    else if (change.name == "length") building.length = change.after;
+}
+
+void applyFieldChange(Floor &floor, FieldChange const &change) {
+    if (change.name == "type") floor.type = static_cast<FloorType>(change.after);
+    else if (change.name == "height") floor.height = change.after;
+}
+
+void applyFieldChange(Room &room, FieldChange const &change) {
+    if (change.name == "type") room.type = static_cast<RoomType>(change.after);
+    else if (change.name == "width") room.width = change.after;
+    else if (change.name == "length") room.length = change.after;
+}
+
+int getFieldValue(Sector const &sector, string const &name) {
+    if (name == "plotWidth") return sector.plotWidth;
+    if (name == "plotLength") return sector.plotLength;
+    return 0;
+}
+
+int getFieldValue(Building const &building, string const &name) {
+    if (name == "type") return static_cast<int>(building.type);
+    if (name == "isStove") return building.isStove;
+    if (name == "isPlaced") return building.isPlaced;
+    if (name == "x") return building.x;
+    if (name == "y") return building.y;
+    if (name == "width") return building.width;
+    if (name == "length") return building.length;
+    return 0;
+}
+
+int getFieldValue(Floor const &floor, string const &name) {
+    if (name == "type") return static_cast<int>(floor.type);
+    if (name == "height") return floor.height;
+    return 0;
+}
+
+int getFieldValue(Room const &room, string const &name) {
+    if (name == "type") return static_cast<int>(room.type);
+    if (name == "width") return room.width;
+    if (name == "length") return room.length;
+    return 0;
+}
+
+// Изменения узла применяются целиком, если каждое поле всё ещё равно before (или уже равно after).
+// Иначе поле успели изменить по-другому: это конфликт, узел не меняется
+template<class T>
+bool applyFieldChanges(T &node, vector<FieldChange> const &fields) {
+    for (auto const &change : fields) {
+        int current = getFieldValue(node, change.name);
+        if (current != change.before && current != change.after) return false;
+    }
+    for (auto const &change : fields) applyFieldChange(node, change);
+
+    return true;
+}
+
+template<class T>
+T* findChildById(vector<T> &children, int id) {
+    auto it = std::find_if(children.begin(), children.end(), [id](T const &child) { return child.id == id; });
+
+    return it != children.end() ? &(*it) : nullptr;
+}
+
+Sector const* getDiffSource(DiffEntry const &entry, Sector const*) { return entry.sector; }
+Building const* getDiffSource(DiffEntry const &entry, Building const*) { return entry.building; }
+Floor const* getDiffSource(DiffEntry const &entry, Floor const*) { return entry.floor; }
+Room const* getDiffSource(DiffEntry const &entry, Room const*) { return entry.room; }
+
+// Относится ли изменение к потомкам узла с цепочкой idPath
+bool isInDiffSubtree(DiffEntry const &entry, vector<int> const &idPath) {
+    return entry.idPath.size() > idPath.size() && std::equal(idPath.begin(), idPath.end(), entry.idPath.begin());
+}
+
+void mergeNode(Sector &sector, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts);
+void mergeNode(Building &building, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts);
+void mergeNode(Floor &floor, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts);
+void mergeNode(Room &room, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts);
+
+// diff упорядочен так же, как его строит getAreaDiff: от родителя к потомкам, соседи по возрастанию id.
+// Поэтому изменения и дочерние элементы сливаются за один проход, как в diffChildren
+// Изменяемые участки копируются (getEditableNode), остальные переходят в новую версию без копирования
+template<class C>
+void mergeChildren(vector<C> &children, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts) {
+    if (position >= diff.size() || !isInDiffSubtree(diff[position], idPath)) return;
+
+    using T = typename std::decay<decltype(getNode(children.front()))>::type;
+    auto isLess = [](C const &a, C const &b) { return getNode(a).id < getNode(b).id; };
+    if (!std::is_sorted(children.begin(), children.end(), isLess)) std::sort(children.begin(), children.end(), isLess);
+
+    vector<C> merged;
+    merged.reserve(children.size());
+    size_t depth = idPath.size();
+    size_t i = 0;
+
+    while (position < diff.size() && isInDiffSubtree(diff[position], idPath)) {
+        auto const &entry = diff[position];
+        int id = entry.idPath[depth];
+        while (i < children.size() && getNode(children[i]).id < id) merged.push_back(std::move(children[i++]));
+
+        bool isExisting = i < children.size() && getNode(children[i]).id == id;
+        bool isOwnEntry = entry.idPath.size() == depth + 1;
+        idPath.push_back(id);
+
+        if (isOwnEntry && entry.kind == DiffKind::added) {
+            auto const* source = getDiffSource(entry, static_cast<T const*>(nullptr));
+            if (isExisting || !source) ++conflicts;
+            else addChild(merged, *source);
+            ++position;
+        }
+        // Изменять или удалять нечего
+        else if (!isExisting) {
+            ++conflicts;
+            ++position;
+        }
+        else {
+            bool isRemoved = false;
+            if (isOwnEntry) {
+                if (entry.kind == DiffKind::removed) isRemoved = true;
+                else if (!applyFieldChanges(getEditableNode(children[i]), entry.fields)) ++conflicts;
+                ++position;
+            }
+
+            // Узел без изменений ниже не копируется
+            if (position < diff.size() && isInDiffSubtree(diff[position], idPath)) {
+                mergeNode(getEditableNode(children[i]), diff, position, idPath, conflicts);
+            }
+            if (!isRemoved) merged.push_back(std::move(children[i]));
+            ++i;
+        }
+
+        idPath.pop_back();
+    }
+
+    while (i < children.size()) merged.push_back(std::move(children[i++]));
+    children = std::move(merged);
+}
+
+void mergeNode(Sector &sector, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts) {
+    size_t first = position;
+    mergeChildren(sector.children, diff, position, idPath, conflicts);
+
+    // План участка зависит лишь от зданий, изменения этажей и комнат его не затрагивают
+    bool isLayoutChanged = std::any_of(diff.begin() + first, diff.begin() + position, [](DiffEntry const &entry) {
+        return entry.level == NodeLevel::building;
+    });
+    if (isLayoutChanged) sector.spatialIndex.reset();
+}
+
+void mergeNode(Building &building, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts) {
+    mergeChildren(building.children, diff, position, idPath, conflicts);
+}
+
+void mergeNode(Floor &floor, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts) {
+    mergeChildren(floor.children, diff, position, idPath, conflicts);
+}
+
+// У комнаты нет дочерних элементов: изменения ниже неё применить некуда
+void mergeNode(Room &, vector<DiffEntry> const &diff, size_t &position, vector<int> &idPath, int &conflicts) {
+    while (position < diff.size() && isInDiffSubtree(diff[position], idPath)) {
+        ++conflicts;
+        ++position;
+    }
+}
+
+// Применяет изменения к территории. Возвращает количество изменений, которые применить не удалось
+int mergeAreaDiff(Area &area, vector<DiffEntry> const &diff) {
+    int conflicts = 0;
+    size_t position = 0;
+    vector<int> idPath;
+    mergeChildren(area.children, diff, position, idPath, conflicts);
+
+    // Изменения вне порядка getAreaDiff не применяются
+    return conflicts + static_cast<int>(diff.size() - position);
+}
+
+void showAreaDiff(std::ostream &out, vector<DiffEntry> const &diff) {
+    const char* levelNames[] = { "SECTOR", "BUILDING", "FLOOR", "ROOM" };
+    const char* kindMarks[] = { "+", "-", "~" };
+
+    if (diff.empty()) out << "Изменений нет" << endl;
+
+    for (auto const &entry : diff) {
+        out << kindMarks[static_cast<int>(entry.kind)] << " ";
+        for (int i = 0; i < entry.idPath.size(); ++i) {
+            out << levelNames[i] << " " << entry.idPath[i] << (i != entry.idPath.size() - 1 ? "/" : "");
+        }
+        out << endl;
+
+        for (auto const &change : entry.fields) {
+            out << "      " << change.name << ": " << change.before << " -> " << change.after << endl;
+        }
+    }
+}
+
+// --- --- --- --- --- ---
+
+// Приблизительно: строки до 15 символов хранятся внутри самого объекта string
+size_t getStringHeapBytes(string const &str) {
+    const size_t SHORT_STRING_CAPACITY = 15;
+    return str.capacity() > SHORT_STRING_CAPACITY ? str.capacity() + 1 : 0;
+}
+
+size_t getStringsBytes(vector<string> const &strings) {
+    size_t bytes = strings.capacity() * sizeof(string);
+    for (auto const &str : strings) bytes += getStringHeapBytes(str);
+
+    return bytes;
+}
+
+// T -> struct of Room|Floor|Building|Sector
+template<class T>
+void addChildrenMemoryUsage(MemoryReport &report, NodeLevel level, vector<T> const &children) {
+    auto &usage = report.levels[static_cast<int>(level)];
+    usage.count += children.size();
+    usage.nodeBytes += children.size() * sizeof(T);
+    usage.slackBytes += (children.capacity() - children.size()) * sizeof(T);
+}
+
+// Оценка блока счётчиков make_shared: указатель на таблицу виртуальных функций и два счётчика ссылок
+const size_t SHARED_COUNTERS_BYTES = sizeof(void*) + 2 * sizeof(int);
+
+template<class T>
+size_t getVectorBytes(vector<T> const &items) {
+    return items.capacity() * sizeof(T);
+}
+
+// Планы участков разделяются версиями, поэтому каждый учитывается один раз
+void addSpatialIndexMemoryUsage(MemoryReport &report, vector<SectorSpatialIndex const*> &counted, SectorSpatialIndex const* index) {
+    if (!index || isIncludes(counted, index)) return;
+    counted.push_back(index);
+
+    ++report.spatialIndexCount;
+    report.spatialIndexBytes += sizeof(SectorSpatialIndex) + SHARED_COUNTERS_BYTES + getVectorBytes(index->cellStarts) +
+                                getVectorBytes(index->cellItems) + getVectorBytes(index->rects) + getVectorBytes(index->buildingIds);
+}
+
+// Участки тоже разделяются версиями: каждый учитывается один раз, а каждая версия - своим вектором указателей
+void addAreaMemoryUsage(MemoryReport &report, vector<Sector const*> &countedSectors, vector<SectorSpatialIndex const*> &countedIndexes,
+                        Area const &area) {
+    auto &usage = report.levels[static_cast<int>(NodeLevel::sector)];
+    usage.nodeBytes += area.children.size() * sizeof(area.children.front());
+    usage.slackBytes += (area.children.capacity() - area.children.size()) * sizeof(area.children.front());
+
+    for (auto const &sectorPtr : area.children) {
+        if (isIncludes(countedSectors, sectorPtr.get())) continue;
+        countedSectors.push_back(sectorPtr.get());
+
+        auto const &sector = *sectorPtr;
+        ++usage.count;
+        usage.nodeBytes += sizeof(Sector) + SHARED_COUNTERS_BYTES;
+        if (sector.summary) usage.nodeBytes += sizeof(AreaSummary) + SHARED_COUNTERS_BYTES;
+        addSpatialIndexMemoryUsage(report, countedIndexes, sector.spatialIndex.get());
+        addChildrenMemoryUsage(report, NodeLevel::building, sector.children);
+        for (auto const &building : sector.children) {
+            addChildrenMemoryUsage(report, NodeLevel::floor, building.children);
+            for (auto const &floor : building.children) addChildrenMemoryUsage(report, NodeLevel::room, floor.children);
+        }
+    }
+}
+
+// Учитываются текущий снимок и версии, которые хранит сама программа (retained, например snapshot для revert).
+// Старые снимки, которые ещё держат читатели, не видны и не учитываются
+MemoryReport getMemoryReport(RegionSnapshot const &snapshot, vector<std::shared_ptr<const AreaVersion>> const &retained = {}) {
+    MemoryReport report;
+    report.snapshotBytes = sizeof(RegionSnapshot) + SHARED_COUNTERS_BYTES + getVectorBytes(snapshot.areas);
+
+    vector<AreaVersion const*> countedVersions;
+    vector<Sector const*> countedSectors;
+    vector<SectorSpatialIndex const*> countedIndexes;
+    auto addVersion = [&](std::shared_ptr<const AreaVersion> const &areaVersion) {
+        if (!areaVersion || isIncludes(countedVersions, areaVersion.get())) return;
+        countedVersions.push_back(areaVersion.get());
+
+        ++report.areaCount;
+        report.areaBytes += sizeof(AreaVersion) + SHARED_COUNTERS_BYTES;
+        addAreaMemoryUsage(report, countedSectors, countedIndexes, areaVersion->area);
+    };
+    for (auto const &areaVersion : snapshot.areas) addVersion(areaVersion);
+    for (auto const &areaVersion : retained) addVersion(areaVersion);
+
+    report.sharedStringBytes = getStringsBytes(Building::buildingNames) + getStringsBytes(Floor::floorNames) + getStringsBytes(Room::roomNames);
+
+    return report;
+}
+
+void showMemoryReport(std::ostream &out, MemoryReport const &report) {
+    const char* levelNames[] = { "SECTOR", "BUILDING", "FLOOR", "ROOM" };
+    size_t totalBytes = report.areaBytes + report.spatialIndexBytes + report.snapshotBytes + report.sharedStringBytes;
+    size_t totalSlackBytes = 0;
+
+    out << "MEMORY: использование памяти (байт):" << endl;
+    out << std::left << std::setw(9) << "AREA" << std::right << ": элементов " << report.areaCount << ", занято " << report.areaBytes << endl;
+    for (int i = 0; i < report.levels.size(); ++i) {
+        auto const &usage = report.levels[i];
+        out << std::left << std::setw(9) << levelNames[i] << std::right << ": элементов " << usage.count
+            << ", занято " << usage.nodeBytes << ", запас ёмкости " << usage.slackBytes << endl;
+        totalBytes += usage.nodeBytes + usage.slackBytes;
+        totalSlackBytes += usage.slackBytes;
+    }
+    out << "Планы участков ------------- : " << report.spatialIndexCount << ", занято " << report.spatialIndexBytes << endl;
+    out << "Снимок --------------------- : " << report.snapshotBytes << endl;
+    out << "Названия типов (общие) ----- : " << report.sharedStringBytes << endl;
+    out << "Всего ---------------------- : " << totalBytes << ", из них запас ёмкости " << totalSlackBytes << endl;
+    out << "Учтены текущий снимок и сохранённые версии. Снимки, которые ещё используют читатели, не учтены" << endl;
+    out << endl;
+}
+
+void compactNode(Sector &sector);
+void compactNode(Building &building);
+void compactNode(Floor &floor);
+void compactNode(Room &room);
 
-    return footprint;
+// Убирает запас ёмкости векторов дочерних элементов на всех уровнях
+template<class T>
+void compactChildren(vector<T> &children) {
+    children.shrink_to_fit();
+    for (auto &child : children) compactNode(child);
 }
 
+void compactNode(Sector &sector) { compactChildren(sector.children); }
+void compactNode(Building &building) { compactChildren(building.children); }
+void compactNode(Floor &floor) { compactChildren(floor.children); }
+void compactNode(Room &) {}
 
-void showRoom(Room const &room) {
-    cout << room.path << ": информация:" << endl;
-    cout << "            Комната id ----- : " << room.id << endl;
-    cout << "            Тип ------------ : " << room.roomNames[static_cast<int>(room.type)] << endl;
-    cout << "            Ширина --------- : " << room.width << endl;
-    cout << "            Длина ---------- : " << room.length << endl;
-    cout << "            Площадь (м2) --- : " << std::fixed << std::setprecision(2) << getRoomFootprint(room) << endl;
-    cout << endl;
+// Все участки копируются заново: сжатие меняет ёмкости векторов, а опубликованные участки неизменяемы
+void compactArea(Area &area) {
+    area.children.shrink_to_fit();
+    for (auto &sector : area.children) compactNode(getEditableSector(sector));
 }
 
-void showFloor(Floor const &floor, bool isFullInfo = true) {
-    cout << floor.path << ": информация:" << endl;
-    cout << "        Этаж id ------------ : " << floor.id << endl;
-    cout << "        Тип ---------------- : " << floor.floorNames[static_cast<int>(floor.type)] << endl;
-    cout << "        Высота ------------- : " << floor.height << endl;
-    cout << "        Количество комнат -- : " << floor.children.size() << endl;
-    cout << "        Площадь этажа (м2) - : " << std::fixed << std::setprecision(2) << getFloorFootprint(floor) << endl;
-    cout << endl;
+// --- --- --- --- --- ---
 
-    if (!floor.children.empty() && isFullInfo) {
-        for (auto const &room : floor.children) {
-            showRoom(room);
-            cout << "-----------------------------" << endl;
-        }
+// План и сводка считаются лишь для участков, изменённых с прошлой версии: у остальных они уже есть
+std::shared_ptr<const AreaVersion> getAreaVersion(Area area) {
+    for (auto &sectorPtr : area.children) {
+        if (sectorPtr->spatialIndex && sectorPtr->summary) continue;
+
+        auto &sector = getEditableSector(sectorPtr);
+        if (!sector.spatialIndex) sector.spatialIndex = std::make_shared<const SectorSpatialIndex>(buildSectorSpatialIndex(sector));
+        sector.summary = std::make_shared<const AreaSummary>(getSectorSummary(sector));
     }
+    auto summary = getAreaSummary(area);
+    return std::make_shared<const AreaVersion>(AreaVersion{ std::move(area), summary });
 }
 
-void showBuilding(Building const &building, bool isFullInfo = true) {
-    cout << building.path << ": информация:" << endl;
-    cout << "    Здание id -------------- : " << building.id << endl;
-    cout << "    Тип -------------------- : " << building.buildingNames[static_cast<int>(building.type)] << endl;
-    cout << "    Наличие печи ----------- : " << (building.isStove ? "Есть" : "Нет") << endl;
-    cout << "    Количество этажей ------ : " << building.children.size() << endl;
-    cout << "    Площадь дома (м2) ------ : " << std::fixed << std::setprecision(2) << getBuildingFootprint(building) << endl;
-    cout << endl;
+// Копия указателя на текущий снимок. std::atomic_load для shared_ptr в libstdc++ не lock-free:
+// копия делается под мьютексом из внутреннего пула, который писатель берёт лишь на время подмены указателя.
+// Частые чтения идут через RegionReader
+std::shared_ptr<const RegionSnapshot> getRegionSnapshot(RegionStore const &store) {
+    return std::atomic_load(&store.current);
+}
 
-    if (!building.children.empty() && isFullInfo) {
-        for (auto const &floor : building.children) {
-            showFloor(floor);
-            cout << "-----------------------------" << endl;
-        }
+// Пока версия не сменилась, снимок возвращается после одного атомарного чтения номера, без блокировок.
+// Снимок может отстать от писателя лишь на время между подменой указателя и номера версии
+std::shared_ptr<const RegionSnapshot> const &getRegionSnapshot(RegionReader &reader) {
+    if (!reader.snapshot || reader.snapshot->version != reader.store->version.load(std::memory_order_acquire)) {
+        reader.snapshot = getRegionSnapshot(*reader.store);
     }
+
+    return reader.snapshot;
 }
 
-void showSector(Sector const &sector, bool isFullInfo = true) {
-    cout << sector.path << ": информация:" << endl;
-    cout << "Сектор id ------------------ :" << sector.id << endl;
-    cout << "Количество зданий ---------- :" << sector.children.size() << endl;
-    cout << endl;
+// Вызывается под writerMutex. Новый снимок копирует лишь указатели на версии территорий
+void publishAreaVersion(RegionStore &store, int areaIndex, std::shared_ptr<const AreaVersion> areaVersion) {
+    auto snapshot = std::make_shared<RegionSnapshot>(*getRegionSnapshot(store));
+    ++snapshot->version;
+    if (areaIndex >= snapshot->areas.size()) snapshot->areas.resize(areaIndex + 1);
+    snapshot->areas[areaIndex] = std::move(areaVersion);
 
-    if (!sector.children.empty() && isFullInfo) {
-        for (auto const &building : sector.children) {
-            showBuilding(building);
-            cout << "-----------------------------" << endl;
-        }
-    }
+    auto version = snapshot->version;
+    std::atomic_store(&store.current, std::shared_ptr<const RegionSnapshot>(std::move(snapshot)));
+    store.version.store(version, std::memory_order_release);
 }
 
-void showExistingSectors(vector<Sector> const &sectors) {
-    if (!sectors.empty()) {
-        for (auto const &sector : sectors) showSector(sector);
+void publishArea(RegionStore &store, int areaIndex, Area area) {
+    auto areaVersion = getAreaVersion(std::move(area));
+    std::lock_guard<std::mutex> lock(store.writerMutex);
+    publishAreaVersion(store, areaIndex, std::move(areaVersion));
+}
+
+// Под writerMutex переносит изменённую копию base на последнюю версию и публикует её.
+// При isAtomic версия с конфликтами переноса не публикуется. Возвращает количество конфликтов
+int commitAreaEdit(RegionStore &store, int areaIndex, std::shared_ptr<const AreaVersion> const &base, Area area, bool isAtomic) {
+    std::lock_guard<std::mutex> lock(store.writerMutex);
+    auto latest = getRegionSnapshot(store)->areas.at(areaIndex);
+
+    int conflicts = 0;
+    if (latest != base) {
+        Area merged = latest->area;
+        conflicts = mergeAreaDiff(merged, getAreaDiff(base->area, area));
+        area = std::move(merged);
     }
+
+    if (!isAtomic || conflicts == 0) publishAreaVersion(store, areaIndex, getAreaVersion(std::move(area)));
+
+    return conflicts;
+}
+
+// Изменение выполняется над копией территории и не блокирует ни читателей, ни других писателей.
+// Копируется лишь вектор указателей на участки (O(число участков)); участок, взятый на изменение,
+// копируется целиком (getEditableSector). План и сводка пересчитываются только для изменённых участков,
+// сводка территории складывается из сводок участков. Diff и перенос пропускают общие участки.
+// Если за время изменения территорию опубликовал другой писатель, изменения переносятся
+// на его версию через diff. Возвращает количество изменений, которые перенести не удалось
+template<class F>
+int editArea(RegionStore &store, int areaIndex, F edit) {
+    auto base = getRegionSnapshot(store)->areas.at(areaIndex);
+    Area area = base->area;
+    edit(area);
+
+    return commitAreaEdit(store, areaIndex, base, std::move(area), false);
+}
+
+// Изменение «всё или ничего»: edit возвращает false, если изменение нужно отменить.
+// Версия не публикуется и тогда, когда перенос на версию другого писателя дал конфликты.
+// Возвращает true, если версия опубликована
+template<class F>
+bool tryEditArea(RegionStore &store, int areaIndex, F edit, int &conflicts) {
+    auto base = getRegionSnapshot(store)->areas.at(areaIndex);
+    Area area = base->area;
+    conflicts = 0;
+    if (!edit(area)) return false;
+
+    conflicts = commitAreaEdit(store, areaIndex, base, std::move(area), true);
+
+    return conflicts == 0;
 }
 
 // Нужно лишь количество элементов базового типа
@@ -404,35 +1743,31 @@ vector<int> getAvailableBuildingTypeNumbers(Sector const &sector) {
 }
 
 
-int getIndexFromAvailableTypeList(vector<int> const &availableTypeNumbers, vector<string> const &names, const char* path) {
-    // Преобразовываем в список string для обработки в selectFromList
-    vector<string> typeNames;
-    typeNames.reserve(availableTypeNumbers.size());
-    for (auto const &typeNumber : availableTypeNumbers) typeNames.push_back(names[typeNumber]);
-
+// Возвращает номер выбранного типа (а не позицию в списке доступных)
+int getIndexFromAvailableTypeList(vector<int> const &availableTypeNumbers, WordResolver const &resolver, const char* path) {
     cout << "Возможные типы: " << endl;
-    auto indexType = selectFromList(typeNames);
+    auto typeNumber = selectWord(resolver, availableTypeNumbers);
     cout << "-----------------------------------------------" << endl;
-    printf("%s: тип установлен как: %s\n", path, names[indexType].c_str());
-    return indexType;
+    printf("%s: тип установлен как: %s\n", path, resolver.words[typeNumber].c_str());
+    return typeNumber;
 }
 
-void removeCommand(string const &key, vector<string> &list) {
-    removeKeyFromVector<string>(key, list);
+void removeCommand(MenuCommand command, vector<int> &commands) {
+    removeKeyFromVector(static_cast<int>(command), commands);
 }
 
 // Позволим пользователю выбрать из доступных типов нужный ему
-RoomType getRoomType(vector<int> const &availableTypeNumbers, vector<string> const &roomNames, const char* path) {
-    return static_cast<RoomType>(getIndexFromAvailableTypeList(availableTypeNumbers, roomNames, path));
+RoomType getRoomType(vector<int> const &availableTypeNumbers, const char* path) {
+    return static_cast<RoomType>(getIndexFromAvailableTypeList(availableTypeNumbers, getTypeResolver(NodeLevel::room), path));
 }
 
 // Позволим пользователю выбрать из доступных типов нужный ему
-FloorType getFloorType(vector<int> const &availableTypes, vector<string> const &floorNames, const char* path) {
-    return static_cast<FloorType>(getIndexFromAvailableTypeList(availableTypes, floorNames, path));
+FloorType getFloorType(vector<int> const &availableTypes, const char* path) {
+    return static_cast<FloorType>(getIndexFromAvailableTypeList(availableTypes, getTypeResolver(NodeLevel::floor), path));
 }
 
-BuildingType getBuildingType(vector<int> const &availableTypes, vector<string> const &buildingNames, const char* path) {
-    return static_cast<BuildingType>(getIndexFromAvailableTypeList(availableTypes, buildingNames, path));
+BuildingType getBuildingType(vector<int> const &availableTypes, const char* path) {
+    return static_cast<BuildingType>(getIndexFromAvailableTypeList(availableTypes, getTypeResolver(NodeLevel::building), path));
 }
 
 // --- --- --- --- --- ---
@@ -441,14 +1776,14 @@ int changeNumericProperty(int propertyValue, string const &propertyName, const c
     cout << "-----------------------------------------------" << endl;
     printf("%s: %s (%i)?\n", path, propertyName.c_str(), propertyValue);
 
-    return (selectFromList({ "yes", "no" }) == 0) ? getUserNumeric(constraints) : propertyValue;
+    return (selectYesOrNo()) ? getUserNumeric(constraints) : propertyValue;
 }
 
 bool changeBoolProperty(bool propertyValue, string const &propertyName, const char* path) {
     cout << "-----------------------------------------------" << endl;
     printf("%s: %s (%s)?\n", path, propertyName.c_str(), (propertyValue ? "есть" : "нет"));
 
-    return (selectFromList({ "yes", "no" }) == 0) ? !propertyValue : propertyValue;
+    return (selectYesOrNo()) ? !propertyValue : propertyValue;
 }
 
 // availableTypes - перечень типов, которые можно создавать
@@ -456,8 +1791,8 @@ void setRoom(Room &room, vector<int> const &availableTypeNumbersForRoom, Buildin
     if (buildingType == BuildingType::house) {
         cout << "-----------------------------------------------" << endl;
         printf("%s: изменяем тип комнаты (%s)?\n", room.path, room.roomNames[static_cast<int>(room.type)].c_str());
-        if (selectFromList({ "yes", "no" }) == 0) {
-            room.type = getRoomType(availableTypeNumbersForRoom, room.roomNames, room.path);
+        if (selectYesOrNo()) {
+            room.type = getRoomType(availableTypeNumbersForRoom, room.path);
         }
     }
     // Для всех типов зданий кроме house устанавливаем лишь один тип комнаты: main
@@ -493,8 +1828,8 @@ void setFloor(Floor &floor, vector<int> const &availableFloorTypes, BuildingType
     if (buildingType == BuildingType::house) {
         cout << "-----------------------------------------------" << endl;
         printf("%s: изменяем тип этажа (%s)?\n", floor.path, floor.floorNames[static_cast<int>(floor.type)].c_str());
-        if (selectFromList({"yes", "no"}) == 0) {
-            floor.type = getFloorType(availableFloorTypes, floor.floorNames, floor.path);
+        if (selectYesOrNo()) {
+            floor.type = getFloorType(availableFloorTypes, floor.path);
         }
     }
     // Для всех типов зданий кроме house устанавливаем лишь один тип этажа: first
@@ -510,47 +1845,47 @@ void setFloor(Floor &floor, vector<int> const &availableFloorTypes, BuildingType
     // --- Изменения типов и количества комнат на этаже ---
     cout << "-----------------------------------------------" << endl;
     cout << floor.path << ": вносим изменения в список комнат на этаже?" << endl;
-    showFloor(floor);
-    if (selectFromList({"yes", "no"}) == 0) {
-        vector<string> commands = {"add", "edit", "about", "exit"};
+    showFloor(std::cout, floor);
+    if (selectYesOrNo()) {
+        auto commands = getMenuCommands({ MenuCommand::add, MenuCommand::edit, MenuCommand::about, MenuCommand::exit });
 
         while (true) {
             cout << "-----------------------------------------------" << endl;
             cout << floor.path << ": операции с комнатами этажа:" << endl;
 
             // Пытаемся найти пункт меню. Индекс найден, если >= 0
-            auto index = findKeyIndexInVector<string>("add", commands);
+            auto index = findKeyIndexInVector(static_cast<int>(MenuCommand::add), commands);
 
-            int selectedCommand;
+            MenuCommand selectedCommand;
 
             // Если в списке дочерних ничего нет, то сразу выбираем команду add
             if (floor.children.empty()) {
-                selectedCommand = index;
+                selectedCommand = MenuCommand::add;
             }
             // В ином случае - добавляем/удаляем пункты меню и выбираем уже из них
             else {
                 // Набираем меню для здания house
                 if (buildingType == BuildingType::house) {
-                    if (floor.children.size() < floor.maxRoomCount && index == -1) commands.emplace_back("add");
-                    else if (floor.children.size() >= floor.maxRoomCount && index >= 0) removeCommand("add", commands);
+                    if (floor.children.size() < floor.maxRoomCount && index == -1) commands.emplace_back(static_cast<int>(MenuCommand::add));
+                    else if (floor.children.size() >= floor.maxRoomCount && index >= 0) removeCommand(MenuCommand::add, commands);
                 }
                 // Набираем меню для зданий кроме house
                 else {
-                    if (floor.children.empty() && index == -1) commands.emplace_back("add");
-                    else if (!floor.children.empty() && index >= 0) removeCommand("add", commands);
+                    if (floor.children.empty() && index == -1) commands.emplace_back(static_cast<int>(MenuCommand::add));
+                    else if (!floor.children.empty() && index >= 0) removeCommand(MenuCommand::add, commands);
                 }
 
-                selectedCommand = selectFromList(commands);
+                selectedCommand = selectMenuCommand(commands);
             }
 
             // Получаем возможные типы для rooms
             auto availableTypeNumbersForRoom = getAvailableRoomTypeNumbers(floor, buildingType);
 
-            if (commands[selectedCommand] == "add") {
+            if (selectedCommand == MenuCommand::add) {
                 auto newId = getAvailableIndexInRooms(floor.children);
                 floor.children.emplace_back(getNewRoom(newId, availableTypeNumbersForRoom, buildingType));
             }
-            else if (commands[selectedCommand] == "edit") {
+            else if (selectedCommand == MenuCommand::edit) {
                 if (floor.children.empty()) {
                     cout << "Пока редактировать нечего: список пуст" << endl;
                     continue;
@@ -574,10 +1909,10 @@ void setFloor(Floor &floor, vector<int> const &availableFloorTypes, BuildingType
 
                 setRoom(floor.children[selectedItemForChange], availableTypeNumbersForRoom, buildingType);
             }
-            else if (commands[selectedCommand] == "about") {
-                showFloor(floor);
+            else if (selectedCommand == MenuCommand::about) {
+                showFloor(std::cout, floor);
             }
-            else if (commands[selectedCommand] == "exit") {
+            else if (selectedCommand == MenuCommand::exit) {
                 break;
             }
         }
@@ -594,60 +1929,124 @@ Floor getNewFloor(int newId, vector<int> const& availableFloorTypes, BuildingTyp
     return floor;
 }
 
+bool isStoveAllowed(BuildingType type) {
+    return type == BuildingType::house || type == BuildingType::bathHouse;
+}
+
+// Габариты проверяются и здесь: размещение можно включить, не задавая размеров (по умолчанию 0 x 0)
+string getBuildingPlacementError(Sector const &sector, Building const &building) {
+    if (!building.isPlaced) return "";
+
+    bool isSizeValid = building.width >= building.minPlacedSize && building.width <= building.maxPlacedSize &&
+                       building.length >= building.minPlacedSize && building.length <= building.maxPlacedSize;
+    if (!isSizeValid) {
+        return "габариты размещённого здания должны быть в диапазоне (" + std::to_string(building.minPlacedSize) + " - " +
+               std::to_string(building.maxPlacedSize) + ")";
+    }
+    if (!isFreeSpace(*getSectorSpatialIndex(sector), getBuildingRect(building), building.id)) {
+        return "место занято другим зданием или выходит за границы участка";
+    }
+
+    return "";
+}
+
+// Все проверки здания на участке для сценариев (в меню типы и печь ограничены самим выбором). Пустая строка - ошибок нет.
+// Здание может быть ещё не добавлено на участок; его прежняя версия (тот же id) не учитывается
+string getBuildingError(Sector const &sector, Building const &building) {
+    // Типы зданий на участке не повторяются (кроме undefined)
+    bool isTypeTaken = building.type != BuildingType::undefined &&
+                       std::any_of(sector.children.begin(), sector.children.end(), [&building](Building const &other) {
+                           return other.id != building.id && other.type == building.type;
+                       });
+    if (isTypeTaken) return "здание такого типа уже есть на участке";
+    if (building.isStove && !isStoveAllowed(building.type)) return "печь возможна лишь в house и bathHouse";
+
+    return getBuildingPlacementError(sector, building);
+}
+
+// --- Расположение здания на плане участка ---
+void setBuildingPlacement(Building &building) {
+    string placementTitle = "изменяем размещение здания на плане участка";
+    building.isPlaced = changeBoolProperty(building.isPlaced, placementTitle, building.path);
+    if (building.isPlaced) {
+        vector<int> sizeRange = { building.minPlacedSize, building.maxPlacedSize };
+        building.x = changeNumericProperty(building.x, "изменяем координату x", building.path, { 0, 1000000 });
+        building.y = changeNumericProperty(building.y, "изменяем координату y", building.path, { 0, 1000000 });
+        building.width = changeNumericProperty(building.width, "изменяем ширину здания", building.path, sizeRange);
+        building.length = changeNumericProperty(building.length, "изменяем длину здания", building.path, sizeRange);
+    }
+}
+
+// Ошибочное размещение в модель не попадает: оно запрашивается заново, пока не станет допустимым
+// или пользователь не откажется от размещения здания на плане
+void checkBuildingPlacement(Sector const &sector, Building &building) {
+    string error;
+    while (!(error = getBuildingPlacementError(sector, building)).empty()) {
+        cout << "-----------------------------------------------" << endl;
+        cout << building.path << ": ошибка: " << error << endl;
+        setBuildingPlacement(building);
+    }
+}
+
 void setBuilding(Building &building, vector<int> const &availableBuildingTypes) {
     cout << "-----------------------------------------------" << endl;
     printf("%s: изменяем тип этажа (%s)?\n", building.path, building.buildingNames[static_cast<int>(building.type)].c_str());
-    if (selectFromList({ "yes", "no" }) == 0) {
-        building.type = getBuildingType(availableBuildingTypes, building.buildingNames, building.path);
+    if (selectYesOrNo()) {
+        building.type = getBuildingType(availableBuildingTypes, building.path);
     }
 
-    if (building.type == BuildingType::house || building.type == BuildingType::bathHouse) {
+    if (isStoveAllowed(building.type)) {
         string title = "изменяем наличие печи";
         building.isStove = changeBoolProperty(building.isStove, title, building.path);
     }
+    else {
+        building.isStove = false;
+    }
+
+    setBuildingPlacement(building);
 
     // --- Изменения типов и количества этажей в здании ---
     cout << "-----------------------------------------------" << endl;
     cout << building.path << ": вносим изменения в список этажей в здании?" << endl;
-    showBuilding(building);
-    if (selectFromList({"yes", "no"}) == 0) {
-        vector<string> commands = {"add", "edit", "about", "exit"};
+    showBuilding(std::cout, building);
+    if (selectYesOrNo()) {
+        auto commands = getMenuCommands({ MenuCommand::add, MenuCommand::edit, MenuCommand::about, MenuCommand::exit });
 
         while (true) {
             cout << "-----------------------------------------------" << endl;
             cout << building.path << ": операции с этажами здания:" << endl;
 
             // Пытаемся найти пункт меню. Индекс найден, если >= 0
-            auto index = findKeyIndexInVector<string>("add", commands);
+            auto index = findKeyIndexInVector(static_cast<int>(MenuCommand::add), commands);
 
-            int selectedCommand;
+            MenuCommand selectedCommand;
 
             // Если в списке дочерних ничего нет, то сразу выбираем команду add
-            if (building.children.empty()) selectedCommand = index;
+            if (building.children.empty()) selectedCommand = MenuCommand::add;
             // В ином случае - добавляем/удаляем пункты меню и выбираем уже из них
             else {
                 // Набираем меню для здания house
                 if (building.type == BuildingType::house) {
-                    if (building.children.size() < building.maxFloorCountForHouse && index == -1) commands.emplace_back("add");
-                    else if (building.children.size() >= building.maxFloorCountForHouse && index >= 0) removeCommand("add", commands);
+                    if (building.children.size() < building.maxFloorCountForHouse && index == -1) commands.emplace_back(static_cast<int>(MenuCommand::add));
+                    else if (building.children.size() >= building.maxFloorCountForHouse && index >= 0) removeCommand(MenuCommand::add, commands);
                 }
                 // Набираем меню для зданий кроме house
                 else {
-                    if (building.children.empty() && index == -1) commands.emplace_back("add");
-                    else if (!building.children.empty() && index >= 0) removeCommand("add", commands);
+                    if (building.children.empty() && index == -1) commands.emplace_back(static_cast<int>(MenuCommand::add));
+                    else if (!building.children.empty() && index >= 0) removeCommand(MenuCommand::add, commands);
                 }
 
-                selectedCommand = selectFromList(commands);
+                selectedCommand = selectMenuCommand(commands);
             }
 
             // Получаем возможные типы для floors
             vector<int> availableFloorTypes = getAvailableFloorTypeNumbers(building);
 
-            if (commands[selectedCommand] == "add") {
+            if (selectedCommand == MenuCommand::add) {
                 auto newId = getAvailableIndexInFloors(building.children);
                 building.children.emplace_back(getNewFloor(newId, availableFloorTypes, building.type));
             }
-            else if (commands[selectedCommand] == "edit") {
+            else if (selectedCommand == MenuCommand::edit) {
                 if (building.children.empty()) {
                     cout << "Пока редактировать нечего: список пуст" << endl;
                     continue;
@@ -663,10 +2062,10 @@ void setBuilding(Building &building, vector<int> const &availableBuildingTypes)
 
                 setFloor(building.children[selectedItemForChange], availableFloorTypes, building.type);
             }
-            else if (commands[selectedCommand] == "about") {
-                showBuilding(building);
+            else if (selectedCommand == MenuCommand::about) {
+                showBuilding(std::cout, building);
             }
-            else if (commands[selectedCommand] == "exit") {
+            else if (selectedCommand == MenuCommand::exit) {
                 break;
             }
         }
@@ -684,12 +2083,19 @@ Building getNewBuilding(int newId, vector<int> const& availableBuildingTypes) {
 }
 
 void setSector(Sector &sector) {
+    string title = "изменяем ширину участка (0 - неизвестна)";
+    sector.plotWidth = changeNumericProperty(sector.plotWidth, title, sector.path, { 0, 1000000 });
+
+    title = "изменяем длину участка (0 - неизвестна)";
+    sector.plotLength = changeNumericProperty(sector.plotLength, title, sector.path, { 0, 1000000 });
+    sector.spatialIndex.reset();
+
     // --- Изменения типов и количества зданий на участке ---
     cout << "-----------------------------------------------" << endl;
     cout << sector.path << ": вносим изменения в список зданий на участке?" << endl;
-    showSector(sector);
-    if (selectFromList({"yes", "no"}) == 0) {
-        vector<string> commands = {"add", "edit", "about", "exit"};
+    showSector(std::cout, sector);
+    if (selectYesOrNo()) {
+        auto commands = getMenuCommands({ MenuCommand::add, MenuCommand::edit, MenuCommand::about, MenuCommand::exit });
 
         while (true) {
             cout << "-----------------------------------------------" << endl;
@@ -698,17 +2104,19 @@ void setSector(Sector &sector) {
             // Если в списке дочерних ничего нет, то сразу выбираем команду add,
             // иначе добавляем/удаляем пункты меню и выбираем уже из них
             auto selectedCommand = sector.children.empty() ?
-                                   findKeyIndexInVector<string>("add", commands) :
-                                   selectFromList(commands);
+                                   MenuCommand::add :
+                                   selectMenuCommand(commands);
 
             // Вычисляем незанятые типы для building, т.к. они должны быть оригинальными
             auto availableBuildingTypes = getAvailableBuildingTypeNumbers(sector);
 
-            if (commands[selectedCommand] == "add") {
+            if (selectedCommand == MenuCommand::add) {
                 auto newId = getAvailableIndexInBuildings(sector.children);
                 sector.children.emplace_back(getNewBuilding(newId, availableBuildingTypes));
+                sector.spatialIndex.reset();
+                checkBuildingPlacement(sector, sector.children.back());
             }
-            else if (commands[selectedCommand] == "edit") {
+            else if (selectedCommand == MenuCommand::edit) {
                 if (sector.children.empty()) {
                     cout << "Пока редактировать нечего: список пуст" << endl;
                     continue;
@@ -723,11 +2131,13 @@ void setSector(Sector &sector) {
                 }
 
                 setBuilding(sector.children[selectUserItemForChange], availableBuildingTypes);
+                sector.spatialIndex.reset();
+                checkBuildingPlacement(sector, sector.children[selectUserItemForChange]);
             }
-            else if (commands[selectedCommand] == "about") {
-                showSector(sector);
+            else if (selectedCommand == MenuCommand::about) {
+                showSector(std::cout, sector);
             }
-            else if (commands[selectedCommand] == "exit") {
+            else if (selectedCommand == MenuCommand::exit) {
                 break;
             }
         }
@@ -748,28 +2158,28 @@ void setArea(Area &area) {
     // --- Изменения секторов на территории ---
     cout << "-----------------------------------------------" << endl;
     cout << area.path << ": вносим изменения в список секторов на территории?" << endl;
-    showExistingSectors(area.children);
-    if (selectFromList({"yes", "no"}) == 0) {
-        vector<string> commands = {"add", "edit", "about", "exit"};
+    showExistingSectors(std::cout, area.children);
+    if (selectYesOrNo()) {
+        auto commands = getMenuCommands({ MenuCommand::add, MenuCommand::edit, MenuCommand::about, MenuCommand::exit });
 
         while (true) {
             cout << "-----------------------------------------------" << endl;
             cout << area.path << ": операции со секторами на территории:" << endl;
 
             // Пытаемся найти пункт меню. Индекс найден, если >= 0
-            auto index = findKeyIndexInVector<string>("add", commands);
+            auto index = findKeyIndexInVector(static_cast<int>(MenuCommand::add), commands);
 
             // Если в списке дочерних ничего нет, то сразу выбираем команду add,
             // иначе добавляем/удаляем пункты меню и выбираем уже из них
             auto selectedCommand = area.children.empty() ?
-                                   findKeyIndexInVector<string>("add", commands) :
-                                   selectFromList(commands);
+                                   MenuCommand::add :
+                                   selectMenuCommand(commands);
 
-            if (commands[selectedCommand] == "add") {
+            if (selectedCommand == MenuCommand::add) {
                 auto newId = getAvailableIndexInSectors(area.children);
-                area.children.emplace_back(getNewSector(newId));
+                area.children.push_back(std::make_shared<Sector>(getNewSector(newId)));
             }
-            else if (commands[selectedCommand] == "edit") {
+            else if (selectedCommand == MenuCommand::edit) {
                 if (area.children.empty()) {
                     cout << "Пока редактировать нечего: список пуст" << endl;
                     continue;
@@ -784,12 +2194,12 @@ void setArea(Area &area) {
                     selectUserItemForChange = getUserNumeric({0, (int)numberOfSectors - 1});
                 }
 
-                setSector(area.children[selectUserItemForChange]);
+                setSector(getEditableSector(area.children[selectUserItemForChange]));
             }
-            else if (commands[selectedCommand] == "about") {
-                showExistingSectors(area.children);
+            else if (selectedCommand == MenuCommand::about) {
+                showExistingSectors(std::cout, area.children);
             }
-            else if (commands[selectedCommand] == "exit") {
+            else if (selectedCommand == MenuCommand::exit) {
                 break;
             }
         }
@@ -806,34 +2216,793 @@ Area createArea(int newId) {
     return area;
 }
 
-int main() {
+// --- --- --- --- --- ---
+
+const vector<ScriptProperty> scriptProperties = {
+    { NodeLevel::sector, ScriptKey::plotWidth, "plotWidth", 0, 1000000 },
+    { NodeLevel::sector, ScriptKey::plotLength, "plotLength", 0, 1000000 },
+    { NodeLevel::building, ScriptKey::stove, "isStove", 0, 1 },
+    { NodeLevel::building, ScriptKey::placed, "isPlaced", 0, 1 },
+    { NodeLevel::building, ScriptKey::x, "x", 0, 1000000 },
+    { NodeLevel::building, ScriptKey::y, "y", 0, 1000000 },
+    { NodeLevel::building, ScriptKey::width, "width", Building::minPlacedSize, Building::maxPlacedSize },
+    { NodeLevel::building, ScriptKey::length, "length", Building::minPlacedSize, Building::maxPlacedSize },
+    { NodeLevel::floor, ScriptKey::height, "height", 2000, 4000 },
+    { NodeLevel::room, ScriptKey::width, "width", 1000, 5000 },
+    { NodeLevel::room, ScriptKey::length, "length", 1000, 5000 },
+};
+
+// Разбивает текст на команды по ';' и переводу строки. '#' - комментарий до конца строки
+vector<std::pair<int, vector<string>>> getScriptStatements(string const &text) {
+    vector<std::pair<int, vector<string>>> statements;
+    vector<string> tokens;
+    string token;
+    int line = 1;
+    bool isComment = false;
+
+    auto flushToken = [&]() {
+        if (!token.empty()) tokens.push_back(std::move(token));
+        token.clear();
+    };
+    auto flushStatement = [&]() {
+        flushToken();
+        if (!tokens.empty()) statements.emplace_back(line, std::move(tokens));
+        tokens.clear();
+    };
+
+    for (char c : text) {
+        if (c == '\n') {
+            flushStatement();
+            isComment = false;
+            ++line;
+        }
+        else if (isComment) continue;
+        else if (c == '#') isComment = true;
+        else if (c == ';') flushStatement();
+        else if (std::isspace(static_cast<unsigned char>(c))) flushToken();
+        else token += c;
+    }
+    flushStatement();
+
+    return statements;
+}
+
+bool parseScriptNumber(string const &text, int &value) {
+    auto answer = resolveWord(getAnswerResolver(), text);
+    if (answer >= 0) value = answer == 0 ? 1 : 0;
+    else {
+        char* end = nullptr;
+        errno = 0;
+        long number = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0') return false;
+        // long шире int не на всех платформах: проверяем оба переполнения
+        if (errno == ERANGE || number < std::numeric_limits<int>::min() || number > std::numeric_limits<int>::max()) return false;
+        value = static_cast<int>(number);
+    }
+
+    return true;
+}
+
+// Возвращает текст ошибки. Пустая строка - команда разобрана
+string parseScriptCommand(vector<string> const &tokens, ScriptCommand &command) {
+    auto verbIndex = resolveWord(getScriptVerbResolver(), tokens[0]);
+    if (verbIndex < 0) return getWordError(verbIndex, "неизвестная команда: ", tokens[0]);
+    command.verb = static_cast<ScriptVerb>(verbIndex);
+
+    if (command.verb == ScriptVerb::about || command.verb == ScriptVerb::exit) {
+        return tokens.size() == 1 ? "" : "лишние аргументы у команды " + tokens[0];
+    }
+
+    if (tokens.size() < 2) return "не указан уровень: sector|building|floor|room";
+    auto levelIndex = resolveWord(getLevelResolver(), tokens[1]);
+    if (levelIndex < 0) return getWordError(levelIndex, "неизвестный уровень: ", tokens[1]);
+    command.level = static_cast<NodeLevel>(levelIndex);
+
+    for (int i = 2; i < tokens.size(); ++i) {
+        auto const &token = tokens[i];
+        auto delimiter = token.find('=');
+
+        // Позиционный аргумент: id для edit, тип для add
+        if (delimiter == string::npos) {
+            if (command.verb == ScriptVerb::edit && command.id == -1) {
+                if (!parseScriptNumber(token, command.id) || command.id < 0) return "неверный id: " + token;
+            }
+            else if (command.verb == ScriptVerb::add && command.type == -1 && command.level != NodeLevel::sector) {
+                command.type = resolveWord(getTypeResolver(command.level), token);
+                if (command.type < 0) return getWordError(command.type, "неизвестный тип: ", token);
+            }
+            else return "лишний аргумент: " + token;
+            continue;
+        }
+
+        auto key = token.substr(0, delimiter);
+        auto text = token.substr(delimiter + 1);
+
+        // Префикс ключа должен быть уникален среди ключей своего уровня
+        auto isLevelKey = [&command](int word) {
+            auto scriptKey = static_cast<ScriptKey>(word);
+            if (scriptKey == ScriptKey::type) return command.level != NodeLevel::sector;
+            return std::any_of(scriptProperties.begin(), scriptProperties.end(), [&](ScriptProperty const &p) {
+                return p.level == command.level && p.key == scriptKey;
+            });
+        };
+        auto keyIndex = resolveWord(getScriptKeyResolver(), key, isLevelKey);
+        if (keyIndex < 0) return getWordError(keyIndex, "неизвестное свойство: ", key);
+
+        if (static_cast<ScriptKey>(keyIndex) == ScriptKey::type) {
+            command.type = resolveWord(getTypeResolver(command.level), text);
+            if (command.type < 0) return getWordError(command.type, "неизвестный тип: ", text);
+            continue;
+        }
+
+        auto property = std::find_if(scriptProperties.begin(), scriptProperties.end(), [&](ScriptProperty const &p) {
+            return p.level == command.level && p.key == static_cast<ScriptKey>(keyIndex);
+        });
+        if (property == scriptProperties.end()) return "неизвестное свойство: " + key;
+
+        int value;
+        if (!parseScriptNumber(text, value)) return "неверное значение: " + token;
+        if (value < property->min || value > property->max) {
+            return getScriptKeyResolver().words[keyIndex] + " должно быть в диапазоне (" + std::to_string(property->min) + " - " + std::to_string(property->max) + ")";
+        }
+
+        command.properties.push_back({ property->field, 0, value });
+    }
+
+    if (command.verb == ScriptVerb::edit && command.id == -1) return "не указан id";
+
+    return "";
+}
+
+// Разбор выполняется один раз для всего сценария. Ошибки разбора выводятся в out
+vector<ScriptCommand> parseScript(string const &text, std::ostream &out, int &errors) {
+    vector<ScriptCommand> commands;
+    auto statements = getScriptStatements(text);
+    commands.reserve(statements.size());
+    bool isSingleLine = statements.empty() || statements.front().first == statements.back().first;
+
+    for (int i = 0; i < statements.size(); ++i) {
+        auto const &statement = statements[i];
+        ScriptCommand command;
+        command.position = (isSingleLine ? "Команда " : "Строка " + std::to_string(statement.first) + ", команда ") + std::to_string(i + 1);
+        auto error = parseScriptCommand(statement.second, command);
+        if (!error.empty()) {
+            out << command.position << ": " << error << endl;
+            ++errors;
+            continue;
+        }
+
+        commands.emplace_back(std::move(command));
+    }
+
+    return commands;
+}
+
+bool isPlacementField(string const &field) {
+    return field == "x" || field == "y" || field == "width" || field == "length";
+}
+
+// Проверки повторяют ограничения интерактивного меню
+string applyScriptToSector(Area &area, ScriptCursor &cursor, ScriptCommand const &command) {
+    Sector* sector;
+    if (command.verb == ScriptVerb::add) {
+        auto newId = getAvailableIndexInSectors(area.children);
+        auto created = std::make_shared<Sector>();
+        created->id = newId;
+        sector = created.get();
+        area.children.push_back(std::move(created));
+    }
+    else {
+        auto it = std::find_if(area.children.begin(), area.children.end(), [&command](std::shared_ptr<const Sector> const &child) {
+            return child->id == command.id;
+        });
+        if (it == area.children.end()) return "нет участка с id " + std::to_string(command.id);
+        sector = &getEditableSector(*it);
+    }
+
+    for (auto const &property : command.properties) applyFieldChange(*sector, property);
+    cursor = { sector, nullptr, nullptr };
+
+    return "";
+}
+
+string applyScriptToBuilding(ScriptCursor &cursor, ScriptCommand const &command) {
+    if (!cursor.sector) return "сначала выберите участок";
+    auto &sector = *cursor.sector;
+
+    Building* building = command.verb == ScriptVerb::edit ? findChildById(sector.children, command.id) : nullptr;
+    if (command.verb == ScriptVerb::edit && !building) return "нет здания с id " + std::to_string(command.id);
+
+    // Изменения готовятся на копии (в здании не больше нескольких этажей) и применяются лишь после проверки
+    Building candidate;
+    if (building) candidate = *building;
+    else candidate.id = getAvailableIndexInBuildings(sector.children);
+
+    if (command.type != -1) candidate.type = static_cast<BuildingType>(command.type);
+    if (!isStoveAllowed(candidate.type)) candidate.isStove = false;
+    for (auto const &property : command.properties) {
+        applyFieldChange(candidate, property);
+        if (isPlacementField(property.name)) candidate.isPlaced = true;
+    }
+
+    auto error = getBuildingError(sector, candidate);
+    if (!error.empty()) return error;
+
+    if (building) *building = std::move(candidate);
+    else {
+        sector.children.emplace_back(std::move(candidate));
+        building = &sector.children.back();
+    }
+    sector.spatialIndex.reset();
+
+    cursor.building = building;
+    cursor.floor = nullptr;
+
+    return "";
+}
+
+string applyScriptToFloor(ScriptCursor &cursor, ScriptCommand const &command) {
+    if (!cursor.building) return "сначала выберите здание";
+    auto &building = *cursor.building;
+    bool isHouse = building.type == BuildingType::house;
+
+    Floor* floor = command.verb == ScriptVerb::edit ? findChildById(building.children, command.id) : nullptr;
+    if (command.verb == ScriptVerb::edit && !floor) return "нет этажа с id " + std::to_string(command.id);
+
+    int maxFloorCount = isHouse ? building.maxFloorCountForHouse : 1;
+    if (!floor && building.children.size() >= maxFloorCount) return "в здании уже максимальное количество этажей";
+
+    // Для всех типов зданий кроме house этаж лишь один: first
+    auto type = command.type == -1 ? (floor ? floor->type : FloorType::undefined) : static_cast<FloorType>(command.type);
+    if (!isHouse) type = FloorType::first;
+    bool isSameType = floor && floor->type == type;
+    if (!isSameType && !isIncludes(getAvailableFloorTypeNumbers(building), static_cast<int>(type))) {
+        return "этаж такого типа уже есть в здании";
+    }
+
+    if (!floor) {
+        auto newId = getAvailableIndexInFloors(building.children);
+        building.children.emplace_back();
+        floor = &building.children.back();
+        floor->id = newId;
+    }
+
+    floor->type = type;
+    for (auto const &property : command.properties) applyFieldChange(*floor, property);
+    cursor.floor = floor;
+
+    return "";
+}
+
+string applyScriptToRoom(ScriptCursor &cursor, ScriptCommand const &command) {
+    if (!cursor.floor) return "сначала выберите этаж";
+    auto &floor = *cursor.floor;
+    bool isHouse = cursor.building->type == BuildingType::house;
+
+    Room* room = command.verb == ScriptVerb::edit ? findChildById(floor.children, command.id) : nullptr;
+    if (command.verb == ScriptVerb::edit && !room) return "нет комнаты с id " + std::to_string(command.id);
+
+    int maxRoomCount = isHouse ? floor.maxRoomCount : 1;
+    if (!room && floor.children.size() >= maxRoomCount) return "на этаже уже максимальное количество комнат";
+
+    // Для всех типов зданий кроме house помещение лишь одно: main
+    auto type = command.type == -1 ? (room ? room->type : RoomType::undefined) : static_cast<RoomType>(command.type);
+    if (!isHouse) type = RoomType::main;
+
+    if (!room) {
+        auto newId = getAvailableIndexInRooms(floor.children);
+        floor.children.emplace_back();
+        room = &floor.children.back();
+        room->id = newId;
+    }
+
+    room->type = type;
+    for (auto const &property : command.properties) applyFieldChange(*room, property);
+
+    return "";
+}
+
+string executeScriptCommand(Area &area, ScriptCursor &cursor, ScriptCommand const &command, std::ostream &out) {
+    if (command.verb == ScriptVerb::about) {
+        if (cursor.floor) showFloor(out, *cursor.floor);
+        else if (cursor.building) showBuilding(out, *cursor.building);
+        else if (cursor.sector) showSector(out, *cursor.sector);
+        else showExistingSectors(out, area.children);
+        return "";
+    }
+
+    if (command.verb == ScriptVerb::exit) {
+        if (cursor.floor) cursor.floor = nullptr;
+        else if (cursor.building) cursor.building = nullptr;
+        else cursor.sector = nullptr;
+        return "";
+    }
+
+    if (command.level == NodeLevel::sector) return applyScriptToSector(area, cursor, command);
+    if (command.level == NodeLevel::building) return applyScriptToBuilding(cursor, command);
+    if (command.level == NodeLevel::floor) return applyScriptToFloor(cursor, command);
+
+    return applyScriptToRoom(cursor, command);
+}
+
+// Выполняет весь пакет команд. Ошибочная команда пропускается, выполнение продолжается
+int executeScript(Area &area, vector<ScriptCommand> const &commands, std::ostream &out) {
+    int errors = 0;
+    ScriptCursor cursor;
+
+    for (auto const &command : commands) {
+        auto error = executeScriptCommand(area, cursor, command, out);
+        if (error.empty()) continue;
+
+        out << command.position << ": " << error << endl;
+        ++errors;
+    }
+
+    return errors;
+}
+
+// Неинтерактивный режим. fileName "-" - чтение из stdin. Возвращает количество ошибок
+int runScript(Area &area, string const &fileName, std::ostream &out) {
+    std::ifstream file;
+    if (fileName != "-") {
+        file.open(fileName);
+        if (!file.is_open()) {
+            out << "Не удалось открыть файл: " << fileName << endl;
+            return 1;
+        }
+    }
+
+    std::istream &in = fileName == "-" ? std::cin : file;
+    std::stringstream text;
+    text << in.rdbuf();
+
+    int errors = 0;
+    auto commands = parseScript(text.str(), out, errors);
+    errors += executeScript(area, commands, out);
+
+    out << "Сценарий выполнен. Команд: " << commands.size() << ", ошибок: " << errors << endl;
+
+    return errors;
+}
+
+// --- --- --- --- --- ---
+
+// Ответ: "OK <длина>\n" или "ERR <длина>\n", затем тело указанной длины
+string getServerResponse(bool isError, string const &body) {
+    return (isError ? "ERR " : "OK ") + std::to_string(body.size()) + "\n" + body;
+}
+
+// Запрос - одна строка: summary | about | script <команды через ;> | memory | compact | shutdown.
+// Чтение идёт по снимку, изменения публикуются новой версией территории
+// Запросы, которые останавливают сервер или перестраивают территорию, принимаются лишь целиком:
+// префикс вроде "sh" не должен остановить сервер
+bool isExactServerRequest(string const &requestName) {
+    return requestName == "shutdown" || requestName == "compact";
+}
+
+string getServerRequestName(string const &request, int &requestIndex) {
+    auto name = request.substr(0, request.find(' '));
+    auto const &words = getServerRequestResolver().words;
+    requestIndex = resolveWord(getServerRequestResolver(), name, [&name, &words](int word) {
+        return !isExactServerRequest(words[word]) || name.size() == words[word].size();
+    });
+
+    return requestIndex >= 0 ? getServerRequestResolver().words[requestIndex] : string();
+}
+
+// Запросы чтения работают лишь со снимком, поэтому сервер выполняет их в отдельном потоке
+bool isServerReadRequest(string const &requestName) {
+    return requestName == "summary" || requestName == "about" || requestName == "memory";
+}
+
+string handleServerReadRequest(RegionSnapshot const &snapshot, string const &requestName) {
+    std::ostringstream out;
+    if (requestName == "summary") showRegionSummary(out, snapshot);
+    else if (requestName == "about") showExistingSectors(out, snapshot.areas[0]->area.children);
+    else if (requestName == "memory") showMemoryReport(out, getMemoryReport(snapshot));
+
+    return out.str();
+}
+
+string handleServerRequest(RegionStore &store, string const &request, bool &isError, bool &isShutdown) {
+    std::ostringstream out;
+    auto delimiter = request.find(' ');
+    auto name = request.substr(0, delimiter);
+    auto argument = delimiter == string::npos ? string() : request.substr(delimiter + 1);
+    int requestIndex;
+    auto requestName = getServerRequestName(request, requestIndex);
+    isError = false;
+
+    if (isServerReadRequest(requestName)) {
+        out << handleServerReadRequest(*getRegionSnapshot(store), requestName);
+    }
+    else if (requestName == "script") {
+        // Пакет применяется целиком или не применяется вовсе. Разбор выполняется до начала изменения
+        int errors = 0;
+        int conflicts = 0;
+        auto commands = parseScript(argument, out, errors);
+        bool isApplied = errors == 0 && tryEditArea(store, 0, [&](Area &area) {
+            errors += executeScript(area, commands, out);
+            return errors == 0;
+        }, conflicts);
+        if (conflicts > 0) out << "Конфликтов с другими изменениями: " << conflicts << endl;
+        errors += conflicts;
+        out << "Команд: " << commands.size() << ", ошибок: " << errors << endl;
+        if (!isApplied) out << "Изменения не применены" << endl;
+        isError = !isApplied;
+    }
+    else if (requestName == "compact") {
+        editArea(store, 0, [](Area &area) { compactArea(area); });
+        showMemoryReport(out, getMemoryReport(*getRegionSnapshot(store)));
+    }
+    else if (requestName == "shutdown") {
+        isShutdown = true;
+        out << "Сервер остановлен" << endl;
+    }
+    else {
+        isError = true;
+        out << getWordError(requestIndex, "Неизвестный запрос: ", name) << endl;
+    }
+
+    return out.str();
+}
+
+#ifndef _WIN32
+volatile std::sig_atomic_t isServerStopped = 0;
+
+void stopServer(int) {
+    isServerStopped = 1;
+}
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Ограничения на клиента: принятые, но не обработанные запросы и не отправленные ответы.
+// Пока ответы не отправлены, новые запросы клиента не читаются и не выполняются
+const size_t MAX_SERVER_INPUT_SIZE = 1 << 20;
+const size_t MAX_SERVER_OUTPUT_SIZE = 1 << 20;
+
+bool isServerClientReadable(ServerClient const &client) {
+    return !client.isReadClosed && client.input.size() < MAX_SERVER_INPUT_SIZE && client.output.size() < MAX_SERVER_OUTPUT_SIZE;
+}
+
+// Читает доступные данные, но не больше MAX_SERVER_INPUT_SIZE: остальное ждёт в сокете
+void readServerClient(ServerClient &client) {
+    char buffer[4096];
+
+    while (client.input.size() < MAX_SERVER_INPUT_SIZE) {
+        auto count = read(client.fd, buffer, sizeof(buffer));
+        if (count > 0) {
+            client.input.append(buffer, count);
+            continue;
+        }
+        if (count < 0 && errno == EINTR) continue;
+        if (count == 0) client.isReadClosed = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK) client.isClosed = true;
+        break;
+    }
+}
+
+// Отвечает на полученные строки, пока очередь ответов не превысит MAX_SERVER_OUTPUT_SIZE.
+// Запрос чтения передаётся потоку читателя, и до его ответа клиент ждёт. После shutdown запросы больше не выполняются
+void handleServerClient(RegionStore &store, ServerReader &reader, ServerClient &client, bool &isShutdown) {
+    size_t start = 0;
+    size_t end;
+    while (!isShutdown && !client.isWaiting && client.output.size() < MAX_SERVER_OUTPUT_SIZE &&
+           (end = client.input.find('\n', start)) != string::npos) {
+        auto request = getTrimmedString(client.input.substr(start, end - start));
+        start = end + 1;
+        if (request.empty()) continue;
+
+        int requestIndex;
+        auto requestName = getServerRequestName(request, requestIndex);
+        if (isServerReadRequest(requestName)) {
+            {
+                std::lock_guard<std::mutex> lock(reader.mutex);
+                reader.tasks.push_back({ client.id, requestName, string() });
+            }
+            reader.condition.notify_one();
+            client.isWaiting = true;
+            continue;
+        }
+
+        bool isError;
+        auto body = handleServerRequest(store, request, isError, isShutdown);
+        client.output += getServerResponse(isError, body);
+    }
+    client.input.erase(0, start);
+
+    // Строка длиннее предела так и не завершилась: запрос слишком велик
+    if (client.input.size() >= MAX_SERVER_INPUT_SIZE && client.input.find('\n') == string::npos) client.isClosed = true;
+}
+
+void runServerReader(RegionStore const &store, ServerReader &reader) {
+    RegionReader regionReader;
+    regionReader.store = &store;
+
+    std::unique_lock<std::mutex> lock(reader.mutex);
+    while (true) {
+        reader.condition.wait(lock, [&reader] { return reader.isStopped || !reader.tasks.empty(); });
+        if (reader.tasks.empty()) break;
+
+        auto task = std::move(reader.tasks.front());
+        reader.tasks.pop_front();
+        lock.unlock();
+        task.response = getServerResponse(false, handleServerReadRequest(*getRegionSnapshot(regionReader), task.requestName));
+        lock.lock();
+
+        reader.results.push_back(std::move(task));
+        char signal = 1;
+        // Канал неблокирующий: если он полон, основной поток и так проснётся
+        while (write(reader.wakePipe[1], &signal, 1) < 0 && errno == EINTR) continue;
+    }
+}
+
+// Отдаёт готовые ответы потока читателя их клиентам. Ответы отключившимся клиентам отбрасываются
+void takeServerReadResults(ServerReader &reader, vector<ServerClient> &clients) {
+    char buffer[256];
+    while (read(reader.wakePipe[0], buffer, sizeof(buffer)) > 0) continue;
+
+    vector<ServerReadTask> results;
+    {
+        std::lock_guard<std::mutex> lock(reader.mutex);
+        results.swap(reader.results);
+    }
+
+    for (auto &result : results) {
+        auto client = std::find_if(clients.begin(), clients.end(), [&result](ServerClient const &c) { return c.id == result.clientId; });
+        if (client == clients.end()) continue;
+
+        client->output += result.response;
+        client->isWaiting = false;
+    }
+}
+
+void writeServerClient(ServerClient &client) {
+    while (!client.output.empty()) {
+        auto count = send(client.fd, client.output.data(), client.output.size(), 0);
+        if (count > 0) {
+            client.output.erase(0, count);
+            continue;
+        }
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) client.isClosed = true;
+        break;
+    }
+}
+
+// Основной поток обслуживает всех клиентов через poll и выполняет изменения.
+// Запросы чтения выполняет поток читателя. Возвращает код завершения программы
+int runServer(RegionStore &store, string const &socketPath) {
+    sockaddr_un address{};
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cout << "Слишком длинный путь к сокету: " << socketPath << endl;
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    // Удаляется лишь оставшийся от прошлого запуска сокет, а не произвольный файл по этому пути
+    struct stat status{};
+    if (lstat(socketPath.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            cout << "Путь занят файлом, который не является сокетом: " << socketPath << endl;
+            return 1;
+        }
+        unlink(socketPath.c_str());
+    }
+    else if (errno != ENOENT) {
+        cout << "Не удалось проверить путь " << socketPath << ": " << std::strerror(errno) << endl;
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 || !setNonBlocking(listener)) {
+        cout << "Не удалось открыть сокет " << socketPath << ": " << std::strerror(errno) << endl;
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+
+    ServerReader reader;
+    if (pipe(reader.wakePipe) != 0 || !setNonBlocking(reader.wakePipe[0]) || !setNonBlocking(reader.wakePipe[1])) {
+        cout << "Не удалось создать канал потока читателя: " << std::strerror(errno) << endl;
+        close(listener);
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+
+    // Сигналы остановки должны прерывать poll основного потока, поэтому поток читателя их не принимает
+    sigset_t stopSignals;
+    sigset_t previousSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &previousSignals);
+    std::thread readerThread(runServerReader, std::cref(store), std::ref(reader));
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+
+    cout << "SERVER: ожидание запросов на " << socketPath << endl;
+
+    vector<ServerClient> clients;
+    vector<pollfd> pollFds;
+    long long lastClientId = 0;
+    bool isShutdown = false;
+    // После shutdown ждём отправки готовых ответов, но не дольше этого времени на каждый poll
+    const int SHUTDOWN_TIMEOUT_MS = 5000;
+
+    while (!isServerStopped && !(isShutdown && clients.empty())) {
+        pollFds.clear();
+        // После shutdown новые клиенты не принимаются
+        pollFds.push_back({ listener, static_cast<short>(isShutdown ? 0 : POLLIN), 0 });
+        pollFds.push_back({ reader.wakePipe[0], POLLIN, 0 });
+        for (auto const &client : clients) {
+            short events = (!isShutdown && isServerClientReadable(client) ? POLLIN : 0) | (client.output.empty() ? 0 : POLLOUT);
+            pollFds.push_back({ client.fd, events, 0 });
+        }
+
+        int ready = poll(pollFds.data(), pollFds.size(), isShutdown ? SHUTDOWN_TIMEOUT_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // Клиенты перестали читать ответы: завершаем, не дожидаясь их. Ответы потока читателя дожидаемся всегда
+        bool isReaderBusy = std::any_of(clients.begin(), clients.end(), [](ServerClient const &client) { return client.isWaiting; });
+        if (ready == 0 && !isReaderBusy) break;
+        if (pollFds[1].revents & POLLIN) takeServerReadResults(reader, clients);
+
+        // Клиенты, принятые на этой итерации, попадут в poll на следующей
+        auto polledClients = clients.size();
+        if (pollFds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+                if (!setNonBlocking(fd)) {
+                    close(fd);
+                    continue;
+                }
+                ServerClient client;
+                client.id = ++lastClientId;
+                client.fd = fd;
+                clients.emplace_back(std::move(client));
+            }
+        }
+
+        for (int i = 0; i < polledClients; ++i) {
+            auto &client = clients[i];
+            auto events = pollFds[i + 2].revents;
+
+            if (!isShutdown && isServerClientReadable(client) && (events & (POLLIN | POLLHUP))) readServerClient(client);
+            if (events & (POLLERR | POLLNVAL)) client.isClosed = true;
+            // Запросы, отложенные из-за неотправленных ответов, выполняются, как только очередь ответов освободится
+            handleServerClient(store, reader, client, isShutdown);
+            writeServerClient(client);
+            handleServerClient(store, reader, client, isShutdown);
+            // Соединение закрывается, лишь когда все ответы отправлены
+            if ((client.isReadClosed || isShutdown) && !client.isWaiting && client.output.empty()) client.isClosed = true;
+        }
+
+        auto closed = std::remove_if(clients.begin(), clients.end(), [](ServerClient const &client) {
+            if (client.isClosed) close(client.fd);
+            return client.isClosed;
+        });
+        clients.erase(closed, clients.end());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reader.mutex);
+        reader.isStopped = true;
+    }
+    reader.condition.notify_one();
+    readerThread.join();
+    close(reader.wakePipe[0]);
+    close(reader.wakePipe[1]);
+
+    for (auto &client : clients) {
+        writeServerClient(client);
+        close(client.fd);
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    cout << "SERVER: работа завершена" << endl;
+
+    return 0;
+}
+#else
+int runServer(RegionStore &store, string const &socketPath) {
+    cout << "Режим сервера доступен лишь в POSIX-системах" << endl;
+    return 1;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
     SetConsoleCP(65001);
     SetConsoleOutputCP(65001);
+#endif
+
+    string scriptFileName;
+    string socketPath;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--script") scriptFileName = argv[i + 1];
+        else if (option == "--server") socketPath = argv[i + 1];
+    }
 
-    vector<Area> areas;
+    // Неинтерактивный режим: 21_5_2 --script <файл|->. Подсказки меню не выводятся
+    if (!scriptFileName.empty() && socketPath.empty()) {
+        Area area;
+        return runScript(area, scriptFileName, std::cout) == 0 ? 0 : 1;
+    }
+
+    // Режим сервера: 21_5_2 [--script <файл>] --server <путь к сокету>. Модель загружается один раз
+    if (!socketPath.empty()) {
+        Area area;
+        if (!scriptFileName.empty() && runScript(area, scriptFileName, std::cout) != 0) return 1;
+
+        RegionStore store;
+        publishArea(store, 0, std::move(area));
+        return runServer(store, socketPath);
+    }
 
     cout << "-----------------------------------------------" << endl;
     cout << "START" << endl;
-    Area firstArea = createArea(0);
+    // Все изменения публикуются как новые версии, читатели работают со снимками
+    RegionStore store;
     // Теоретически, территорий можно создать очень много. Но нам, в данном случае, нужна лишь одна
-    areas.emplace_back(firstArea);
+    publishArea(store, 0, createArea(0));
 
-    vector<string> commands = {"edit", "about", "exit"};
+    // Сохранённая версия территории для сравнения (diff) и отката (revert). Версии неизменяемы, копия не нужна
+    auto saved = getRegionSnapshot(store)->areas[0];
+
+    auto commands = getMenuCommands({ MenuCommand::edit, MenuCommand::summary, MenuCommand::snapshot, MenuCommand::diff, MenuCommand::revert,
+                                      MenuCommand::memory, MenuCommand::compact, MenuCommand::about, MenuCommand::exit });
 
     while (true) {
         cout << "-----------------------------------------------" << endl;
         cout << "COMMON MENU: операции с территорией:" << endl;
-        auto selectedCommand = selectFromList(commands); {
-        }
+        auto selectedCommand = selectMenuCommand(commands);
 
-        if (commands[selectedCommand] == "edit") {
+        if (selectedCommand == MenuCommand::edit) {
             // Территория у нас одна единственная
-            setArea(areas[0]);
+            auto conflicts = editArea(store, 0, [](Area &area) { setArea(area); });
+            if (conflicts) cout << "Не удалось применить изменений: " << conflicts << endl;
+        }
+        else if (selectedCommand == MenuCommand::summary) {
+            showRegionSummary(std::cout, *getRegionSnapshot(store));
+        }
+        else if (selectedCommand == MenuCommand::snapshot) {
+            saved = getRegionSnapshot(store)->areas[0];
+            cout << "Состояние территории сохранено" << endl;
+        }
+        else if (selectedCommand == MenuCommand::diff) {
+            showAreaDiff(std::cout, getAreaDiff(saved->area, getRegionSnapshot(store)->areas[0]->area));
+        }
+        else if (selectedCommand == MenuCommand::revert) {
+            // Обратный diff приводит территорию к сохранённому состоянию
+            // Конфликты возможны и при самом откате, и при переносе отката на версию другого писателя
+            int revertConflicts = 0;
+            auto conflicts = editArea(store, 0, [&saved, &revertConflicts](Area &area) {
+                revertConflicts = mergeAreaDiff(area, getAreaDiff(area, saved->area));
+            });
+            conflicts += revertConflicts;
+            cout << "Территория возвращена к сохранённому состоянию. Конфликтов: " << conflicts << endl;
+        }
+        else if (selectedCommand == MenuCommand::memory) {
+            showMemoryReport(std::cout, getMemoryReport(*getRegionSnapshot(store), { saved }));
+        }
+        else if (selectedCommand == MenuCommand::compact) {
+            editArea(store, 0, [](Area &area) { compactArea(area); });
+            showMemoryReport(std::cout, getMemoryReport(*getRegionSnapshot(store), { saved }));
         }
-        else if (commands[selectedCommand] == "about") {
-            showExistingSectors(areas[0].children);
+        else if (selectedCommand == MenuCommand::about) {
+            showExistingSectors(std::cout, getRegionSnapshot(store)->areas[0]->area.children);
         }
-        else if (commands[selectedCommand] == "exit") {
+        else if (selectedCommand == MenuCommand::exit) {
             cout << "Программа закончила работу. До новых встреч" << endl;
             break;
         }